@@ -7,6 +7,8 @@ fn main() {
         .cpp(true)
         .files(&[
             format!("{}/emu65x64.cpp", CC_SOURCES),
+            format!("{}/jit65x64.cpp", CC_SOURCES),
+            format!("{}/journal65x64.cpp", CC_SOURCES),
             format!("{}/mem65x64.cpp", CC_SOURCES),
             format!("{}/nozo65x64.cpp", CC_SOURCES),
         ]);
@@ -23,8 +25,13 @@ fn main() {
 
     println!("cargo:rerun-if-changed={}/emu65x64.cpp", CC_SOURCES);
     println!("cargo:rerun-if-changed={}/emu65x64.hpp", CC_SOURCES);
+    println!("cargo:rerun-if-changed={}/jit65x64.cpp", CC_SOURCES);
+    println!("cargo:rerun-if-changed={}/jit65x64.hpp", CC_SOURCES);
+    println!("cargo:rerun-if-changed={}/journal65x64.cpp", CC_SOURCES);
+    println!("cargo:rerun-if-changed={}/journal65x64.hpp", CC_SOURCES);
     println!("cargo:rerun-if-changed={}/mem65x64.cpp", CC_SOURCES);
     println!("cargo:rerun-if-changed={}/mem65x64.hpp", CC_SOURCES);
     println!("cargo:rerun-if-changed={}/nozo65x64.cpp", CC_SOURCES);
     println!("cargo:rerun-if-changed={}/nozo65x64.hpp", CC_SOURCES);
+    println!("cargo:rerun-if-changed={}/ops65x64.hpp", CC_SOURCES);
 }
@@ -1,7 +1,8 @@
 fn main() {
     println!("Hello, world!");
 
-    let mut ram: Vec<u8> = vec![0; 0x4000_0000];
+    let mut ram: Vec<u8> = vec![0; 0x1000];
+    let mut vectors: Vec<u8> = vec![0; 0x1000];
 
     ram[0] = 0x69; // adc q#1
     ram[1] = 1;
@@ -9,13 +10,16 @@ fn main() {
     ram[12] = 0xDB; // stp
     ram[13] = 0x40; // rti
     ram[14] = 0xDB; // stp
-    ram[0x3fffffd8] = 13;
+    vectors[0xfd8] = 13;
 
-    emu65x64::set_memory_ram(0x3fff_ffff, 0x4000_0000, &mut ram, None);
+    // Both buffers outlive every use of the emulator below
+    unsafe {
+        emu65x64::map_ram(0, &mut ram);
+        emu65x64::map_ram(0x3fff_f000, &mut vectors);
+    }
     emu65x64::reset(true);
     emu65x64::set_pc(0);
 
-    for _ in 0..6 {
-        emu65x64::step();
-    }
+    let reason = emu65x64::run(0, 6);
+    println!("Stopped: {:?}", reason);
 }
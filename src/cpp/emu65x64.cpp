@@ -20,44 +20,52 @@
 //------------------------------------------------------------------------------
 
 #include "emu65x64.hpp"
+#include "jit65x64.hpp"
 
-union emu65x64::FLAGS       emu65x64::p;
+#include <algorithm>
+#include <new>
+#include <system_error>
 
-emu65x64::Byte              emu65x64::r;
-emu65x64::Bit               emu65x64::e;
+#include <errno.h>
 
-union emu65x64::REGS        emu65x64::a;
-union emu65x64::REGS        emu65x64::b;
-union emu65x64::REGS        emu65x64::c;
-union emu65x64::REGS        emu65x64::x;
-union emu65x64::REGS        emu65x64::y;
-union emu65x64::REGS        emu65x64::z;
-union emu65x64::REGS        emu65x64::sp;
-union emu65x64::REGS        emu65x64::tp;
-union emu65x64::REGS        emu65x64::dp;
+emu65x64                    emu65x64::legacy;
 
-emu65x64::Qword          emu65x64::pc;
-emu65x64::Byte          emu65x64::pbr;
-emu65x64::Byte          emu65x64::dbr;
-
-bool                    emu65x64::stopped;
-bool                    emu65x64::interrupted;
-unsigned long           emu65x64::cycles;
-bool                    emu65x64::trace;
+#define OP(CODE, NAME, MODE, MNEM, LEN, CYC)   { MNEM, LEN, CYC, OPERAND_##MODE },
+const emu65x64::OPCODE      emu65x64::opcodes[256] = { OPS65X64(OP) };
+#undef OP
 
 //==============================================================================
 
-// Not used.
+// Create an emulator with cleared registers and no memory attached
 emu65x64::emu65x64()
-{ }
+    : r(0), e(0), pc(0), pbr(0), dbr(0),
+      stopped(false), interrupted(false), raised(false), halted(false),
+      cycles(0), trace(false), fetching(false), watched(false), watchAddr(0),
+      watchKind(0), jit(NULL), deadline(~0UL), scheduled(0),
+      until(~0UL), pending(0), replaying(false), interval(0), depth(0), due(~0UL)
+{
+    setp(0);
+    a.q = b.q = c.q = 0;
+    x.q = y.q = z.q = 0;
+    sp.q = tp.q = dp.q = 0;
+    operand = 0;
+
+    codeChanged(0, ~(Addr)0);
+}
 
-// Not used
 emu65x64::~emu65x64()
-{ }
+{
+#ifdef JIT65X64
+    delete jit;
+#endif
+    delete journal;
+}
 
 // Reset the state of emulator
 void emu65x64::reset(bool trace)
 {
+    bind();
+
     // e = 1;
     // pbr = 0x00;
     // dbr = 0x00;
@@ -67,294 +75,875 @@ void emu65x64::reset(bool trace)
     tp.w = 0x1000;
     sp.w = 0x100;
     pc = getQword(0x3ffffff0);
-    p.b = 0x34;
+    setp(0x34);
 
     stopped = false;
     interrupted = false;
+    raised = false;
+    watched = false;
+    halted = false;
+    pending = 0;
 
     emu65x64::trace = trace;
 }
 
 // Execute a single instruction or invoke an interrupt
-void emu65x64::step()
-{
-    // Check for NMI/IRQ
-
-    SHOWPC();
-
-    switch (getByte(pc++)) {
-    case 0x00:  op_brk(am_immb());  break;
-    case 0x01:  op_ora(am_dpix());  break;
-    case 0x02:  op_cop(am_immb());  break;
-    case 0x03:  op_ora(am_srel());  break;
-    case 0x04:  op_tsb(am_dpag());  break;
-    case 0x05:  op_ora(am_dpag());  break;
-    case 0x06:  op_asl(am_dpag());  break;
-    // case 0x07:  op_ora(am_dpil());  break;
-    case 0x08:  op_php(am_impl());  break;
-    // case 0x09:  op_ora(am_immm());  break;
-    case 0x0a:  op_asla(am_acc());  break;
-    case 0x0b:  op_phd(am_impl());  break;
-    case 0x0c:  op_tsb(am_absl());  break;
-    case 0x0d:  op_ora(am_absl());  break;
-    case 0x0e:  op_asl(am_absl());  break;
-    // case 0x0f:  op_ora(am_alng());  break;
-
-    case 0x10:  op_bpl(am_rela());  break;
-    case 0x11:  op_ora(am_dpiy());  break;
-    case 0x12:  op_ora(am_dpgi());  break;
-    case 0x13:  op_ora(am_sriy());  break;
-    case 0x14:  op_trb(am_dpag());  break;
-    case 0x15:  op_ora(am_dpgx());  break;
-    case 0x16:  op_asl(am_dpgx());  break;
-    // case 0x17:  op_ora(am_dily());  break;
-    case 0x18:  op_clc(am_impl());  break;
-    case 0x19:  op_ora(am_absy());  break;
-    case 0x1a:  op_inca(am_acc());  break;
-    case 0x1b:  op_tcs(am_impl());  break;
-    case 0x1c:  op_trb(am_absl());  break;
-    case 0x1d:  op_ora(am_absx());  break;
-    case 0x1e:  op_asl(am_absx());  break;
-    // case 0x1f:  op_ora(am_alnx());  break;
-
-    case 0x20:  op_jsr(am_absl());  break;
-    case 0x21:  op_and(am_dpix());  break;
-    // case 0x22:  op_jsl(am_alng());  break;
-    case 0x23:  op_and(am_srel());  break;
-    case 0x24:  op_bit(am_dpag());  break;
-    case 0x25:  op_and(am_dpag());  break;
-    case 0x26:  op_rol(am_dpag());  break;
-    // case 0x27:  op_and(am_dpil());  break;
-    case 0x28:  op_plp(am_impl());  break;
-    // case 0x29:  op_and(am_immm());  break;
-    case 0x2a:  op_rola(am_acc());  break;
-    case 0x2b:  op_pld(am_impl());  break;
-    case 0x2c:  op_bit(am_absl());  break;
-    case 0x2d:  op_and(am_absl());  break;
-    case 0x2e:  op_rol(am_absl());  break;
-    // case 0x2f:  op_and(am_alng());  break;
-
-    case 0x30:  op_bmi(am_rela());  break;
-    case 0x31:  op_and(am_dpiy());  break;
-    case 0x32:  op_and(am_dpgi());  break;
-    case 0x33:  op_and(am_sriy());  break;
-    case 0x34:  op_bit(am_dpgx());  break;
-    case 0x35:  op_and(am_dpgx());  break;
-    case 0x36:  op_rol(am_dpgx());  break;
-    // case 0x37:  op_and(am_dily());  break;
-    case 0x38:  op_sec(am_impl());  break;
-    case 0x39:  op_and(am_absy());  break;
-    case 0x3a:  op_deca(am_acc());  break;
-    case 0x3b:  op_tsc(am_impl());  break;
-    case 0x3c:  op_bit(am_absx());  break;
-    case 0x3d:  op_and(am_absx());  break;
-    case 0x3e:  op_rol(am_absx());  break;
-    // case 0x3f:  op_and(am_alnx());  break;
-
-    case 0x40:  op_rti(am_impl());  break;
-    case 0x41:  op_eor(am_dpix());  break;
-    case 0x42:  op_wdm(am_immb());  break;
-    case 0x43:  op_eor(am_srel());  break;
-    case 0x44:  op_mvp(am_immw());  break;
-    case 0x45:  op_eor(am_dpag());  break;
-    case 0x46:  op_lsr(am_dpag());  break;
-    // case 0x47:  op_eor(am_dpil());  break;
-    case 0x48:  op_pha(am_impl());  break;
-    // case 0x49:  op_eor(am_immm());  break;
-    case 0x4a:  op_lsra(am_impl()); break;
-    case 0x4b:  op_phk(am_impl());  break;
-    case 0x4c:  op_jmp(am_absl());  break;
-    case 0x4d:  op_eor(am_absl());  break;
-    case 0x4e:  op_lsr(am_absl());  break;
-    // case 0x4f:  op_eor(am_alng());  break;
-
-    case 0x50:  op_bvc(am_rela());  break;
-    case 0x51:  op_eor(am_dpiy());  break;
-    case 0x52:  op_eor(am_dpgi());  break;
-    case 0x53:  op_eor(am_sriy());  break;
-    case 0x54:  op_mvn(am_immw());  break;
-    case 0x55:  op_eor(am_dpgx());  break;
-    case 0x56:  op_lsr(am_dpgx());  break;
-    // case 0x57:  op_eor(am_dpil());  break;
-    case 0x58:  op_cli(am_impl());  break;
-    case 0x59:  op_eor(am_absy());  break;
-    case 0x5a:  op_phy(am_impl());  break;
-    case 0x5b:  op_tcd(am_impl());  break;
-    // case 0x5c:  op_jmp(am_alng());  break;
-    case 0x5d:  op_eor(am_absx());  break;
-    case 0x5e:  op_lsr(am_absx());  break;
-    // case 0x5f:  op_eor(am_alnx());  break;
-
-    case 0x60:  op_rts(am_impl());  break;
-    case 0x61:  op_adc(am_dpix());  break;
-    case 0x62:  op_per(am_lrel());  break;
-    case 0x63:  op_adc(am_srel());  break;
-    case 0x64:  op_stz(am_dpag());  break;
-    case 0x65:  op_adc(am_dpag());  break;
-    case 0x66:  op_ror(am_dpag());  break;
-    // case 0x67:  op_adc(am_dpil());  break;
-    case 0x68:  op_pla(am_impl());  break;
-    case 0x69:  op_adc(am_immq());  break; // Originally am_immm()
-    case 0x6a:  op_rora(am_impl()); break;
-    case 0x6b:  op_rtl(am_impl());  break;
-    case 0x6c:  op_jmp(am_absi());  break;
-    case 0x6d:  op_adc(am_absl());  break;
-    case 0x6e:  op_ror(am_absl());  break;
-    // case 0x6f:  op_adc(am_alng());  break;
-
-    case 0x70:  op_bvs(am_rela());  break;
-    case 0x71:  op_adc(am_dpiy());  break;
-    case 0x72:  op_adc(am_dpgi());  break;
-    case 0x73:  op_adc(am_sriy());  break;
-    case 0x74:  op_stz(am_dpgx());  break;
-    case 0x75:  op_adc(am_dpgx());  break;
-    case 0x76:  op_ror(am_dpgx());  break;
-    // case 0x77:  op_adc(am_dily());  break;
-    case 0x78:  op_sei(am_impl());  break;
-    case 0x79:  op_adc(am_absy());  break;
-    case 0x7a:  op_ply(am_impl());  break;
-    case 0x7b:  op_tdc(am_impl());  break;
-    case 0x7c:  op_jmp(am_abxi());  break;
-    case 0x7d:  op_adc(am_absx());  break;
-    case 0x7e:  op_ror(am_absx());  break;
-    // case 0x7f:  op_adc(am_alnx());  break;
-
-    case 0x80:  op_bra(am_rela());  break;
-    case 0x81:  op_sta(am_dpix());  break;
-    case 0x82:  op_brl(am_lrel());  break;
-    case 0x83:  op_sta(am_srel());  break;
-    case 0x84:  op_sty(am_dpag());  break;
-    case 0x85:  op_sta(am_dpag());  break;
-    case 0x86:  op_stx(am_dpag());  break;
-    // case 0x87:  op_sta(am_dpil());  break;
-    case 0x88:  op_dey(am_impl());  break;
-    // case 0x89:  op_biti(am_immm()); break;
-    case 0x8a:  op_txa(am_impl());  break;
-    case 0x8b:  op_phb(am_impl());  break;
-    case 0x8c:  op_sty(am_absl());  break;
-    case 0x8d:  op_sta(am_absl());  break;
-    case 0x8e:  op_stx(am_absl());  break;
-    // case 0x8f:  op_sta(am_alng());  break;
-
-    case 0x90:  op_bcc(am_rela());  break;
-    case 0x91:  op_sta(am_dpiy());  break;
-    case 0x92:  op_sta(am_dpgi());  break;
-    case 0x93:  op_sta(am_sriy());  break;
-    case 0x94:  op_sty(am_dpgx());  break;
-    case 0x95:  op_sta(am_dpgx());  break;
-    case 0x96:  op_stx(am_dpgy());  break;
-    // case 0x97:  op_sta(am_dily());  break;
-    case 0x98:  op_tya(am_impl());  break;
-    case 0x99:  op_sta(am_absy());  break;
-    case 0x9a:  op_txs(am_impl());  break;
-    case 0x9b:  op_txy(am_impl());  break;
-    case 0x9c:  op_stz(am_absl());  break;
-    case 0x9d:  op_sta(am_absx());  break;
-    case 0x9e:  op_stz(am_absx());  break;
-    // case 0x9f:  op_sta(am_alnx());  break;
-
-    // case 0xa0:  op_ldy(am_immx());  break;
-    case 0xa1:  op_lda(am_dpix());  break;
-    // case 0xa2:  op_ldx(am_immx());  break;
-    case 0xa3:  op_lda(am_srel());  break;
-    case 0xa4:  op_ldy(am_dpag());  break;
-    case 0xa5:  op_lda(am_dpag());  break;
-    case 0xa6:  op_ldx(am_dpag());  break;
-    // case 0xa7:  op_lda(am_dpil());  break;
-    case 0xa8:  op_tay(am_impl());  break;
-    // case 0xa9:  op_lda(am_immm());  break;
-    case 0xaa:  op_tax(am_impl());  break;
-    case 0xab:  op_plb(am_impl());  break;
-    case 0xac:  op_ldy(am_absl());  break;
-    case 0xad:  op_lda(am_absl());  break;
-    case 0xae:  op_ldx(am_absl());  break;
-    // case 0xaf:  op_lda(am_alng());  break;
-
-    case 0xb0:  op_bcs(am_rela());  break;
-    case 0xb1:  op_lda(am_dpiy());  break;
-    case 0xb2:  op_lda(am_dpgi());  break;
-    case 0xb3:  op_lda(am_sriy());  break;
-    case 0xb4:  op_ldy(am_dpgx());  break;
-    case 0xb5:  op_lda(am_dpgx());  break;
-    case 0xb6:  op_ldx(am_dpgy());  break;
-    // case 0xb7:  op_lda(am_dily());  break;
-    case 0xb8:  op_clv(am_impl());  break;
-    case 0xb9:  op_lda(am_absy());  break;
-    case 0xba:  op_tsx(am_impl());  break;
-    case 0xbb:  op_tyx(am_impl());  break;
-    case 0xbc:  op_ldy(am_absx());  break;
-    case 0xbd:  op_lda(am_absx());  break;
-    case 0xbe:  op_ldx(am_absy());  break;
-    // case 0xbf:  op_lda(am_alnx());  break;
-
-    // case 0xc0:  op_cpy(am_immx());  break;
-    case 0xc1:  op_cmp(am_dpix());  break;
-    case 0xc2:  op_rep(am_immb());  break;
-    case 0xc3:  op_cmp(am_srel());  break;
-    case 0xc4:  op_cpy(am_dpag());  break;
-    case 0xc5:  op_cmp(am_dpag());  break;
-    case 0xc6:  op_dec(am_dpag());  break;
-    // case 0xc7:  op_cmp(am_dpil());  break;
-    case 0xc8:  op_iny(am_impl());  break;
-    // case 0xc9:  op_cmp(am_immm());  break;
-    case 0xca:  op_dex(am_impl());  break;
-    case 0xcb:  op_wai(am_impl());  break;
-    case 0xcc:  op_cpy(am_absl());  break;
-    case 0xcd:  op_cmp(am_absl());  break;
-    case 0xce:  op_dec(am_absl());  break;
-    // case 0xcf:  op_cmp(am_alng());  break;
-
-    case 0xd0:  op_bne(am_rela());  break;
-    case 0xd1:  op_cmp(am_dpiy());  break;
-    case 0xd2:  op_cmp(am_dpgi());  break;
-    case 0xd3:  op_cmp(am_sriy());  break;
-    case 0xd4:  op_pei(am_dpag());  break;
-    case 0xd5:  op_cmp(am_dpgx());  break;
-    case 0xd6:  op_dec(am_dpgx());  break;
-    // case 0xd7:  op_cmp(am_dily());  break;
-    case 0xd8:  op_cld(am_impl());  break;
-    case 0xd9:  op_cmp(am_absy());  break;
-    case 0xda:  op_phx(am_impl());  break;
-    case 0xdb:  op_stp(am_impl());  break;
-    // case 0xdc:  op_jmp(am_abil());  break;
-    case 0xdd:  op_cmp(am_absx());  break;
-    case 0xde:  op_dec(am_absx());  break;
-    // case 0xdf:  op_cmp(am_alnx());  break;
-
-    // case 0xe0:  op_cpx(am_immx());  break;
-    case 0xe1:  op_sbc(am_dpix());  break;
-    case 0xe2:  op_sep(am_immb());  break;
-    case 0xe3:  op_sbc(am_srel());  break;
-    case 0xe4:  op_cpx(am_dpag());  break;
-    case 0xe5:  op_sbc(am_dpag());  break;
-    case 0xe6:  op_inc(am_dpag());  break;
-    // case 0xe7:  op_sbc(am_dpil());  break;
-    case 0xe8:  op_inx(am_impl());  break;
-    // case 0xe9:  op_sbc(am_immm());  break;
-    case 0xea:  op_nop(am_impl());  break;
-    case 0xeb:  op_xba(am_impl());  break;
-    case 0xec:  op_cpx(am_absl());  break;
-    case 0xed:  op_sbc(am_absl());  break;
-    case 0xee:  op_inc(am_absl());  break;
-    // case 0xef:  op_sbc(am_alng());  break;
-
-    case 0xf0:  op_beq(am_rela());  break;
-    case 0xf1:  op_sbc(am_dpiy());  break;
-    case 0xf2:  op_sbc(am_dpgi());  break;
-    case 0xf3:  op_sbc(am_sriy());  break;
-    case 0xf4:  op_pea(am_immw());  break;
-    case 0xf5:  op_sbc(am_dpgx());  break;
-    case 0xf6:  op_inc(am_dpgx());  break;
-    // case 0xf7:  op_sbc(am_dily());  break;
-    case 0xf8:  op_sed(am_impl());  break;
-    case 0xf9:  op_sbc(am_absy());  break;
-    case 0xfa:  op_plx(am_impl());  break;
-    case 0xfb:  op_xce(am_impl());  break;
-    case 0xfc:  op_jsr(am_abxi());  break;
-    case 0xfd:  op_sbc(am_absx());  break;
-    case 0xfe:  op_inc(am_absx());  break;
-    // case 0xff:  op_sbc(am_alnx());  break;
+emu65x64::RESULT emu65x64::step()
+{
+    return (run(0, 1));
+}
+
+// Execute instructions until maxCycles cycles or maxInstructions instructions
+// have been used (zero means no limit) or something needs the caller's
+// attention. A breakpoint at the first instruction is ignored so that a run
+// can resume from it. Execution is split at each scheduled event so that its
+// handler runs at the right cycle, and a halted emulator skips straight to
+// the next event or the end of the cycle budget. While replaying, execution
+// is also split at each journal entry. The trace flag is checked once per run
+// to pick the traced or untraced interpreter.
+emu65x64::RESULT emu65x64::run(unsigned long maxCycles, unsigned long maxInstructions)
+{
+    unsigned long limit = cycles + maxCycles;
+    unsigned long count = maxInstructions ? maxInstructions : ~0UL;
+
+    if (maxCycles == 0 || limit < cycles)
+        limit = ~0UL;
+
+    bind();
+
+    RESULT result = resume(limit, count);
+
+    // Write out the log so that a crash between runs loses none of it
+    if (journal && journal->isRecording())
+        journal->sync();
+    return (result);
+}
+
+// Execute instructions until the cycle count reaches limit or count of them
+// have been used, counting them off
+emu65x64::RESULT emu65x64::resume(unsigned long limit, unsigned long &count)
+{
+    bool resumed = false;
+
+    for (;;) {
+        if (cycles >= deadline)
+            fire();
+        if (cycles >= due)
+            checkpoint();
+
+        unsigned long next = deadline;
+
+        if (isReplaying()) {
+            replayDue();
+            if (journal->isReplaying())
+                journal->next(next);
+            next = std::min(next, deadline);
+        }
+
+        if (raised) {
+            raised = false;
+            if (watched) {
+                watched = false;
+                return (RUN_WATCHPOINT);
+            }
+            return (RUN_INTERRUPT);
+        }
+
+        unsigned long stop = std::min(limit, next);
+        RESULT result;
+
+        if (halted && sleep(stop)) {
+            if (cycles >= limit || cycles < next)
+                return (RUN_HALTED);
+            continue;
+        }
+
+        if (isPending())
+            service();
+
+        if (resumed && !breakpoints.empty() && isBreakpoint(pc))
+            return (RUN_BREAKPOINT);
+        resumed = true;
+
+        // A checkpoint does not end a wait, only a stretch of execution. An
+        // event scheduled during the stretch may bring its end forward.
+        until = std::min(stop, due);
+
+#ifdef JIT65X64
+        // Tracing and breakpoints need the interpreter
+        if (jit && !trace && breakpoints.empty()) {
+            count = jit->run(count);
+            result = finish();
+        }
+        else
+#endif
+        result = trace ? execute<true>(count) : execute<false>(count);
+
+        // Only an event or journal entry falling due is passed over
+        if (count == 0 || cycles >= limit ||
+                (result != RUN_HALTED && result != RUN_BUDGET))
+            return (result);
+    }
+}
+
+// The interpreter, instantiated with and without tracing so that the untraced
+// one has no trace code at all. Each instruction is traced after its
+// addressing mode has consumed the operand bytes and before it executes.
+//
+// With GCC and Clang each handler jumps straight to the next one through a
+// table of label addresses (direct threading) so every opcode has its own
+// dispatch branch. Other compilers fall back to a switch in a loop. Both are
+// generated from the opcode table in ops65x64.hpp.
+template <bool TRACED>
+emu65x64::RESULT emu65x64::execute(unsigned long &budget)
+{
+    unsigned long count = budget;
+
+#define EXECUTE(NAME, MODE, MNEM) \
+    { \
+        Addr at = pc; \
+        Addr ea = am_##MODE(); \
+        \
+        if (TRACED) { \
+            bytes(at, (unsigned int)(pc - at)); \
+            dump(MNEM, ea); \
+        } \
+        op_##NAME(ea); \
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+# define OP(CODE, NAME, MODE, MNEM, LEN, CYC)   &&L_##CODE,
+    static void *const handlers[256] = { OPS65X64(OP) };
+# undef OP
+
+# define DISPATCH() \
+    { \
+        if (TRACED) \
+            show(); \
+        goto *handlers[fetch()]; \
+    }
+# define NEXT() \
+    { \
+        if (--count == 0 || cycles >= until || stopped || halted || raised || \
+                isPending()) \
+            goto done; \
+        if (!breakpoints.empty() && isBreakpoint(pc)) { \
+            budget = count; \
+            return (RUN_BREAKPOINT); \
+        } \
+        DISPATCH(); \
+    }
+
+    DISPATCH();
+
+# define OP(CODE, NAME, MODE, MNEM, LEN, CYC) \
+    L_##CODE: EXECUTE(NAME, MODE, MNEM); NEXT();
+    OPS65X64(OP)
+# undef OP
+# undef NEXT
+# undef DISPATCH
+
+done:
+#else
+    for (;;) {
+        if (TRACED)
+            show();
+
+        switch (fetch()) {
+# define OP(CODE, NAME, MODE, MNEM, LEN, CYC) \
+        case CODE:  EXECUTE(NAME, MODE, MNEM);  break;
+        OPS65X64(OP)
+# undef OP
+        }
+
+        if (--count == 0 || cycles >= until || stopped || halted || raised ||
+                isPending())
+            break;
+        if (!breakpoints.empty() && isBreakpoint(pc)) {
+            budget = count;
+            return (RUN_BREAKPOINT);
+        }
+    }
+#endif
+#undef EXECUTE
+
+    budget = count;
+    return (finish());
+}
+
+// Work out why run() stopped and clear any one-shot condition
+emu65x64::RESULT emu65x64::finish()
+{
+    if (stopped)
+        return (RUN_STOPPED);
+
+    if (halted)
+        return (RUN_HALTED);
+
+    if (watched) {
+        watched = false;
+        raised = false;
+        return (RUN_WATCHPOINT);
+    }
+
+    if (raised) {
+        raised = false;
+        return (RUN_INTERRUPT);
+    }
+
+    return (RUN_BUDGET);
+}
+
+// Let the time a halted emulator spends waiting pass at once. Returns false
+// if an interrupt has ended the wait, like STP/WAI would have, so that
+// execution continues after the instruction. Otherwise the cycles up to the
+// run's limit are skipped, leaving the host to call wait() if it has nothing
+// else to do.
+bool emu65x64::sleep(unsigned long limit)
+{
+    std::lock_guard<std::mutex> lock(idle);
+
+    if (interrupted || (pending && !isReplaying())) {
+        interrupted = false;
+        halted = false;
+        woke();
+        return (false);
+    }
+
+    if (limit != ~0UL)
+        cycles = limit;
+
+    return (true);
+}
+
+// Block the calling thread while STP/WAI is waiting for an interrupt. A
+// replay has its wakeups in the journal so never blocks.
+void emu65x64::wait()
+{
+    std::unique_lock<std::mutex> lock(idle);
+
+    while (halted && !interrupted && !pending && !isReplaying())
+        wakeup.wait(lock);
+}
+
+// Raise interrupt lines. May be called from another thread, waking a thread
+// blocked in wait(). While replaying the journal decides when interrupts are
+// taken, so the lines only count once it has caught up.
+void emu65x64::raise(unsigned int lines)
+{
+    std::lock_guard<std::mutex> lock(idle);
+
+    pending.fetch_or(lines);
+    wakeup.notify_all();
+}
+
+// Enter the handler for the most urgent interrupt line that is not masked.
+// Abort and NMI are taken once for each time they are raised while the IRQ
+// line stays raised until lowered. Lines may be lowered by another thread
+// since isPending() was tested, in which case nothing is entered.
+void emu65x64::service()
+{
+    unsigned int lines = pending & ~masked;
+    unsigned int line = LINE_IRQ;
+
+    if (lines & LINE_ABORT)
+        line = LINE_ABORT;
+    else if (lines & LINE_NMI)
+        line = LINE_NMI;
+    else if (!(lines & LINE_IRQ))
+        return;
+
+    // Abort and NMI are only entered by the call that clears them
+    if (line != LINE_IRQ && !(pending.fetch_and(~line) & line))
+        return;
+
+    // A replay enters the handler from the journal instead
+    if (journal && journal->isRecording())
+        journal->put(journal65x64::ENTRY_SERVICE, line);
+
+    enter(line);
+}
+
+// Enter the handler for an interrupt line, saving pc and the flags as BRK
+// does
+void emu65x64::enter(unsigned int line)
+{
+    Addr vector;
+
+    switch (line) {
+    case LINE_ABORT:    vector = 0x3fffffe0;    break;
+    case LINE_NMI:      vector = 0x3fffffe8;    break;
+    default:            vector = 0x3ffffff8;    break;
+    }
+
+    pushFrame(pc, getp());
+
+    seti(1);
+    setd(0);
+
+    pc = getQword(vector);
+    cycles += 8; // TODO: fix cycles
+}
+
+// Arrange for handler to be called with context once the cycle count reaches
+// when. Events due at the same cycle run in the order they were scheduled.
+// Returns an id for cancel(). When called from a device handler part way
+// through a run the current stretch of execution is cut short so that the
+// event still fires on time.
+unsigned long emu65x64::schedule(unsigned long when, HANDLER handler, void *context)
+{
+    EVENT event = { when, ++scheduled, handler, context };
+
+    events.push_back(event);
+    std::push_heap(events.begin(), events.end(), later);
+    deadline = events.front().when;
+    until = std::min(until, deadline);
+
+    return (event.id);
+}
+
+// Withdraw an event that has not run yet. Returns false if there is none
+// with the given id. The event is found by a linear search and the heap is
+// rebuilt, so this takes time in proportion to the number of pending events.
+bool emu65x64::cancel(unsigned long id)
+{
+    for (size_t index = 0; index < events.size(); ++index) {
+        if (events[index].id == id) {
+            events.erase(events.begin() + index);
+            std::make_heap(events.begin(), events.end(), later);
+            deadline = events.empty() ? ~0UL : events.front().when;
+            return (true);
+        }
+    }
+    return (false);
+}
+
+// Order events so that the heap puts the earliest at the front
+bool emu65x64::later(const EVENT &l, const EVENT &r)
+{
+    return (l.when > r.when || (l.when == r.when && l.id > r.id));
+}
+
+// Run the handlers of all the events that are due. A handler may schedule
+// or cancel other events, including ones that are already due.
+void emu65x64::fire()
+{
+    while (!events.empty() && events.front().when <= cycles) {
+        std::pop_heap(events.begin(), events.end(), later);
+
+        EVENT event = events.back();
+
+        events.pop_back();
+        deadline = events.empty() ? ~0UL : events.front().when;
+        event.handler(event.context, event.when);
+    }
+}
+
+// Choose between translating hot code and interpreting everything. Returns
+// false if translation is not available on this host.
+bool emu65x64::setJit(bool enable)
+{
+#ifdef JIT65X64
+    if (enable && !jit) {
+        jit = new jit65x64(this);
+
+        if (!jit->isReady()) {
+            delete jit;
+            jit = NULL;
+        }
+    }
+    else if (!enable && jit) {
+        delete jit;
+        jit = NULL;
+    }
+    return (jit != NULL || !enable);
+#else
+    return (!enable);
+#endif
+}
+
+//==============================================================================
+// Snapshots
+//------------------------------------------------------------------------------
+
+// Capture the registers and memory. The caller owns the snapshot, which may
+// outlive the emulator it was taken from. Throws std::system_error if the
+// memory cannot be copied.
+emu65x64::SNAPSHOT *emu65x64::snapshot()
+{
+    SNAPSHOT *snapshot = new SNAPSHOT;
+
+    save(*snapshot);
+
+    try {
+        capture(snapshot->memory);
+    }
+    catch (...) {
+        delete snapshot;
+        throw;
+    }
+    return (snapshot);
+}
+
+// Return to the state held in a snapshot. RAM is shared with the snapshot
+// until it is written. Interrupt lines are released. Throws
+// std::system_error, changing nothing, if the memory cannot be mapped.
+void emu65x64::restore(const SNAPSHOT &snapshot)
+{
+    mem65x64::restore(snapshot.memory);
+    load(snapshot);
+
+    interrupted = false;
+    raised = false;
+    watched = false;
+    pending = 0;
+}
+
+// Create another emulator that starts from a snapshot
+emu65x64 *emu65x64::fork(const SNAPSHOT &snapshot)
+{
+    emu65x64 *emu = new emu65x64();
+
+    try {
+        emu->restore(snapshot);
+    }
+    catch (...) {
+        delete emu;
+        throw;
+    }
+    return (emu);
+}
+
+// Copy the registers into state
+void emu65x64::save(STATE &state)
+{
+    state.a = a;
+    state.b = b;
+    state.c = c;
+    state.x = x;
+    state.y = y;
+    state.z = z;
+    state.sp = sp;
+    state.tp = tp;
+    state.dp = dp;
+    state.pc = pc;
+    state.p = getp();
+    state.r = r;
+    state.pbr = pbr;
+    state.dbr = dbr;
+    state.e = e;
+    state.stopped = stopped;
+    state.halted = halted;
+    state.cycles = cycles;
+}
+
+// Set the registers from state
+void emu65x64::load(const STATE &state)
+{
+    a = state.a;
+    b = state.b;
+    c = state.c;
+    x = state.x;
+    y = state.y;
+    z = state.z;
+    sp = state.sp;
+    tp = state.tp;
+    dp = state.dp;
+    pc = state.pc;
+    setp(state.p);
+    r = state.r;
+    pbr = state.pbr;
+    dbr = state.dbr;
+    e = state.e;
+    stopped = state.stopped;
+    halted = state.halted;
+    cycles = state.cycles;
+}
+
+//==============================================================================
+// History
+//------------------------------------------------------------------------------
+
+// Start keeping checkpoints, dropping any already kept. Each holds the
+// registers and the pages stored to until the next one, as they were before,
+// and the inputs are journalled in memory so that execution from any of them
+// can be repeated exactly. Returns false if a journal file is in use.
+bool emu65x64::setHistory(unsigned long interval, unsigned int depth)
+{
+    if (journal && !journal->isKept() &&
+            (journal->isRecording() || journal->isReplaying()))
+        return (false);
+
+    history.clear();
+
+    if (interval == 0 || depth == 0) {
+        emu65x64::interval = 0;
+        due = ~0UL;
+        track(false);
+        if (journal)
+            journal->close();
+        return (true);
+    }
+
+    if (!journal)
+        journal = new journal65x64(&cycles, &replaying);
+
+    emu65x64::interval = interval;
+    emu65x64::depth = depth;
+
+    journal->keep();
+    track(true);
+    checkpoint();
+    return (true);
+}
+
+// Go back to the instruction before the current one. Returns false if the
+// history does not reach back that far.
+bool emu65x64::reverseStep()
+{
+    unsigned long target = cycles;
+    std::vector<Addr> stops;
+    size_t index;
+
+    stops.swap(breakpoints);
+
+    for (index = latest(target); index < history.size(); index = latest(target)) {
+        unsigned long count = ~0UL;
+
+        rewind(index);
+        forward(target, count);
+
+        // Nothing ran, as STP/WAI was waiting, so look before the checkpoint
+        if ((count = ~count) == 0) {
+            target = history[index].state.cycles;
+            continue;
+        }
+
+        rewind(index);
+        --count;
+        forward(~0UL, count);
+        break;
+    }
+
+    breakpoints.swap(stops);
+    return (index < history.size());
+}
+
+// Go back to the last time execution stopped at a breakpoint. Returns false
+// after going back as far as the history reaches without finding one.
+bool emu65x64::reverseContinue()
+{
+    unsigned long target = cycles;
+    size_t oldest = history.size();
+    size_t index;
+
+    for (index = latest(target); index < history.size(); index = latest(target)) {
+        unsigned long found = ~0UL;
+        unsigned long steps = 0;
+
+        // Interrupts due here are taken first, as run() would
+        rewind(index);
+        replayDue();
+        if (isBreakpoint(pc))
+            found = 0;
+
+        // Find the last breakpoint reached before the target
+        while (cycles < target) {
+            unsigned long count = ~0UL;
+            RESULT result = forward(target, count);
+
+            steps += ~count;
+            if (result != RUN_BREAKPOINT)
+                break;
+            if (cycles < target)
+                found = steps;
+        }
+
+        if (found != ~0UL) {
+            std::vector<Addr> stops;
+
+            rewind(index);
+            stops.swap(breakpoints);
+            forward(~0UL, found);
+            breakpoints.swap(stops);
+            return (true);
+        }
+        target = history[index].state.cycles;
+        oldest = index;
+    }
+
+    if (oldest < history.size())
+        rewind(oldest);
+    return (false);
+}
+
+// Close the epoch of the last checkpoint and start a new one here
+void emu65x64::checkpoint()
+{
+    CHECKPOINT point;
+
+    seal(history.empty() ? point.changes : history.back().changes);
+
+    // Older checkpoints are of no use once the memory map has changed
+    if (!history.empty() && history.back().layout != layout)
+        history.clear();
+
+    save(point.state);
+    point.changes = UNDO();
+    point.position = journal->tell(point.stamp);
+    point.layout = layout;
+    history.push_back(point);
+
+    if (history.size() > depth) {
+        history.erase(history.begin());
+        journal->forget(history.front().position);
+    }
+
+    due = (cycles + interval >= cycles) ? cycles + interval : ~0UL;
+}
+
+// Return the index of the latest usable checkpoint before a cycle, or the
+// number of checkpoints if there is none
+size_t emu65x64::latest(unsigned long before) const
+{
+    size_t index = history.size();
+
+    while (index-- > 0) {
+        if (history[index].layout != layout)
+            break;
+        if (history[index].state.cycles < before)
+            return (index);
+    }
+    return (history.size());
+}
+
+// Return to a checkpoint, undoing every store since and dropping the later
+// checkpoints. The journal is replayed from the same point. Interrupt lines
+// keep their live state, which is held off until the replay catches up.
+void emu65x64::rewind(size_t index)
+{
+    seal(history.back().changes);
+
+    for (size_t point = history.size(); point-- > index;)
+        apply(history[point].changes);
+
+    history.erase(history.begin() + index + 1, history.end());
+    history.back().changes = UNDO();
+
+    journal->rewind(history.back().position, history.back().stamp);
+
+    load(history.back().state);
+    interrupted = false;
+
+    due = (cycles + interval >= cycles) ? cycles + interval : ~0UL;
+}
+
+// Execute again from a checkpoint until the cycle count reaches limit or
+// count instructions have been used, counting them off. Tracing is
+// suspended, watchpoints are passed over and interrupts raised meanwhile are
+// passed on afterwards.
+emu65x64::RESULT emu65x64::forward(unsigned long limit, unsigned long &count)
+{
+    bool tracing = trace;
+    bool interrupt = false;
+    RESULT result;
+
+    if (count == 0)
+        return (RUN_BUDGET);
+
+    trace = false;
+    while ((result = resume(limit, count)) == RUN_INTERRUPT ||
+            result == RUN_WATCHPOINT) {
+        interrupt |= (result == RUN_INTERRUPT);
+        if (count == 0)
+            break;
+    }
+    trace = tracing;
+
+    if (interrupt)
+        raised = true;
+    return (result);
+}
+
+//==============================================================================
+// Journal
+//------------------------------------------------------------------------------
+
+// Start logging interrupts, wakeups, WDM #$02 input and MMIO reads to a new
+// file at path. Returns false if it cannot be created. The log is written
+// out each time run() returns. Replaying needs the state the recording
+// started from, such as a snapshot taken beforehand.
+bool emu65x64::record(const char *path)
+{
+    if (interval)
+        setHistory(0, 0);
+    if (!journal)
+        journal = new journal65x64(&cycles, &replaying);
+
+    return (journal->record(path));
+}
+
+// Start feeding back the log at path in place of the live inputs. Returns
+// false if it cannot be read or was not recorded from the current cycle.
+// Replaying ends at the end of the log or where the run stops matching it.
+bool emu65x64::replay(const char *path)
+{
+    if (interval)
+        setHistory(0, 0);
+    if (!journal)
+        journal = new journal65x64(&cycles, &replaying);
+
+    if (!journal->replay(path))
+        return (false);
+
+    std::lock_guard<std::mutex> lock(idle);
+
+    interrupted = false;
+    pending = 0;
+    return (true);
+}
+
+// Finish recording or replaying, writing out any buffered entries. Returns
+// false if some of a recording could not be written.
+bool emu65x64::stopJournal()
+{
+    return (journal ? journal->close() : true);
+}
+
+// Apply the interrupts and wakeups the journal has for the current cycle
+void emu65x64::replayDue()
+{
+    unsigned long when;
+    Byte kind;
+    Qword line;
+
+    while (journal->isReplaying() &&
+            ((kind = journal->next(when)) == journal65x64::ENTRY_SERVICE ||
+                kind == journal65x64::ENTRY_WAKE) && when <= cycles) {
+        if (!journal->take(kind, line))
+            break;
+
+        if (kind == journal65x64::ENTRY_SERVICE)
+            enter((unsigned int)line);
+        else if (halted)
+            halted = false;
+        else
+            interrupted = true;
+    }
+}
+
+// Read a byte for WDM #$02, from the journal if it is replaying
+emu65x64::Byte emu65x64::input()
+{
+    Qword value;
+    Byte data = a.b;
+
+    if (isReplaying() && journal->take(journal65x64::ENTRY_INPUT, value))
+        return ((Byte)value);
+
+    std::cin >> data;
+
+    if (journal && journal->isRecording())
+        journal->put(journal65x64::ENTRY_INPUT, data);
+
+    return (data);
+}
+
+//==============================================================================
+// Decoded Instructions
+//------------------------------------------------------------------------------
+
+// Read the opcode at addr and the operand its addressing mode needs into a
+// cache entry. The entry is only kept if the instruction is in RAM or ROM,
+// whose pages are then watched for stores, and does not wrap around the end
+// of memory where codeChanged() would miss a store to its tail.
+bool emu65x64::decode(DECODED &entry, Addr addr)
+{
+    fetching = true;
+
+    Byte opcode = getByte(addr);
+    unsigned int width = opcodes[opcode].operand;
+
+    switch (width) {
+    case 2:     entry.operand = getWord(addr + 1);  break;
+    case 4:     entry.operand = getDword(addr + 1); break;
+    case 8:     entry.operand = getQword(addr + 1); break;
+    default:    entry.operand = 0;                  break;
     }
+
+    fetching = false;
+
+    entry.opcode = opcode;
+    entry.at = resolve(addr);
+
+    if (resolve(addr + width) >= entry.at && watchCode(addr, addr + width)) {
+        entry.pc = addr;
+        return (true);
+    }
+    entry.pc = addr + 1;
+    return (false);
+}
+
+// Forget decoded instructions that may overlap the resolved addresses from
+// first to last
+void emu65x64::codeChanged(Addr first, Addr last)
+{
+    for (unsigned int index = 0; index < DECODE_SIZE; ++index) {
+        DECODED &entry = decoded[index];
+
+        if (entry.at <= last && entry.at + 8 >= first) {
+            entry.pc = index + 1;
+            entry.at = ~(Addr)0;
+        }
+    }
+
+#ifdef JIT65X64
+    if (jit)
+        jit->codeChanged(first, last);
+#endif
+}
+
+// Note a data access to a watched address and make run() return once the
+// instruction making it is complete. Code fetches are not data accesses.
+void emu65x64::watchHit(Addr ea, unsigned int, unsigned int kind)
+{
+    if (fetching)
+        return;
+
+    watchAddr = ea;
+    watchKind = kind;
+    watched = true;
+    raised = true;
+}
+
+//==============================================================================
+// Breakpoints
+//------------------------------------------------------------------------------
+
+// Stop run() before the instruction at addr is executed
+void emu65x64::setBreakpoint(Addr addr)
+{
+    std::vector<Addr>::iterator it =
+        std::lower_bound(breakpoints.begin(), breakpoints.end(), addr);
+
+    if (it == breakpoints.end() || *it != addr)
+        breakpoints.insert(it, addr);
+}
+
+// Remove a breakpoint set by setBreakpoint
+void emu65x64::clearBreakpoint(Addr addr)
+{
+    std::vector<Addr>::iterator it =
+        std::lower_bound(breakpoints.begin(), breakpoints.end(), addr);
+
+    if (it != breakpoints.end() && *it == addr)
+        breakpoints.erase(it);
+}
+
+// Test for a breakpoint at addr
+bool emu65x64::isBreakpoint(Addr addr) const
+{
+    return (std::binary_search(breakpoints.begin(), breakpoints.end(), addr));
 }
 
 //==============================================================================
@@ -369,59 +958,63 @@ void emu65x64::show()
     // std::cout << ':' << toHex(pc, 4);
     std::cout << toHex(pc, 16);
     // std::cout << ' ' << toHex(getByte(join_w(pbr, pc)), 2);
+    fetching = true;
     std::cout << ' ' << toHex(getByte(pc), 2);
+    fetching = false;
 }
 
 // Display the operand bytes
-void emu65x64::bytes(unsigned int count)
+void emu65x64::bytes(Addr addr, unsigned int count)
 {
     if (count > 8)
         return;
 
     std::cout << ' ';
 
+    fetching = true;
     for (unsigned int i = 0; i < count; i++)
-        std::cout << toHex(getByte(pc + i), 2);
+        std::cout << toHex(getByte(addr + i), 2);
+    fetching = false;
 
     /*
 
     if (count > 0)
-        std::cout << ' ' << toHex(getByte(pc + 0), 2);
+        std::cout << ' ' << toHex(getByte(addr + 0), 2);
     else
         std::cout << "   ";
 
     if (count > 1)
-        std::cout << ' ' << toHex(getByte(pc + 1), 2);
+        std::cout << ' ' << toHex(getByte(addr + 1), 2);
     else
         std::cout << "   ";
 
     if (count > 2)
-        std::cout << ' ' << toHex(getByte(pc + 2), 2);
+        std::cout << ' ' << toHex(getByte(addr + 2), 2);
     else
         std::cout << "   ";
 
     if (count > 3)
-        std::cout << ' ' << toHex(getByte(pc + 3), 2);
+        std::cout << ' ' << toHex(getByte(addr + 3), 2);
     else
         std::cout << "   ";
 
     if (count > 4)
-        std::cout << ' ' << toHex(getByte(pc + 4), 2);
+        std::cout << ' ' << toHex(getByte(addr + 4), 2);
     else
         std::cout << "   ";
 
     if (count > 5)
-        std::cout << ' ' << toHex(getByte(pc + 5), 2);
+        std::cout << ' ' << toHex(getByte(addr + 5), 2);
     else
         std::cout << "   ";
 
     if (count > 6)
-        std::cout << ' ' << toHex(getByte(pc + 6), 2);
+        std::cout << ' ' << toHex(getByte(addr + 6), 2);
     else
         std::cout << "   ";
 
     if (count > 7)
-        std::cout << ' ' << toHex(getByte(pc + 7), 2);
+        std::cout << ' ' << toHex(getByte(addr + 7), 2);
     else
         std::cout << "   ";
 
@@ -455,6 +1048,7 @@ void emu65x64::dump(const char *mnem, Addr ea)
 {
     std::cout << mnem << " {" << toHex(ea, 16) << '}';
 
+    getp();
     std::cout << " R=" << toHex(r, 1);
     std::cout << " P=" <<
         (p.f_n ? 'N' : '.') <<
@@ -517,3 +1111,408 @@ void emu65x64::dump(const char *mnem, Addr ea)
     // std::cout << " DBR=" << toHex(dbr, 2);
     std::cout << std::endl;
 }
+
+// Return the errno value for the exception being handled, so that snapshot
+// failures reach the ffi caller as an error code instead of unwinding into it
+static int failure()
+{
+    try {
+        throw;
+    }
+    catch (const std::system_error &error) {
+        return (error.code().value());
+    }
+    catch (const std::bad_alloc &) {
+        return (ENOMEM);
+    }
+    catch (...) {
+        return (EIO);
+    }
+}
+
+// Rust ffi wrappers
+extern "C" {
+    bool emu65x64_setMemory(unsigned long long memMask, unsigned long long ramSize, const unsigned char *pROM) {
+        return emu65x64::legacy.setMemory(memMask, ramSize, pROM);
+    }
+
+    void emu65x64_setMemoryRam(unsigned long long memMask, unsigned long long ramSize, unsigned char *pRAM, const unsigned char *pROM) {
+        emu65x64::legacy.setMemory(memMask, ramSize, pRAM, pROM);
+    }
+
+    void emu65x64_mapRam(unsigned long long base, unsigned long long size, unsigned char *pHost) {
+        emu65x64::legacy.mapRam(base, size, pHost);
+    }
+
+    void emu65x64_mapRom(unsigned long long base, unsigned long long size, const unsigned char *pHost) {
+        emu65x64::legacy.mapRom(base, size, pHost);
+    }
+
+    bool emu65x64_mapRomFile(unsigned long long base, const char *path) {
+        return emu65x64::legacy.mapRomFile(base, path);
+    }
+
+    void emu65x64_unmap(unsigned long long base, unsigned long long size) {
+        emu65x64::legacy.unmap(base, size);
+    }
+
+    bool emu65x64_mapSparse(unsigned long long base, unsigned long long size) {
+        return emu65x64::legacy.mapSparse(base, size);
+    }
+
+    void emu65x64_mapMmio(unsigned long long base, unsigned long long size) {
+        emu65x64::legacy.mapMmio(base, size);
+    }
+
+    void emu65x64_mapDevice(unsigned long long base, unsigned long long size, const mem65x64::DEVICE *device) {
+        emu65x64::legacy.mapDevice(base, size, *device);
+    }
+
+    unsigned long long emu65x64_getCommitted() {
+        return emu65x64::legacy.getCommitted();
+    }
+
+    unsigned long long emu65x64_getHugeCommitted() {
+        return emu65x64::legacy.getHugeCommitted();
+    }
+
+    unsigned long long emu65x64_getDirty(unsigned long long base, unsigned long long size, unsigned char *bitmap) {
+        return emu65x64::legacy.getDirty(base, size, bitmap);
+    }
+
+    void emu65x64_clearDirty(unsigned long long base, unsigned long long size) {
+        emu65x64::legacy.clearDirty(base, size);
+    }
+
+    void emu65x64_reset(bool trace) {
+        emu65x64::legacy.reset(trace);
+    }
+
+    unsigned int emu65x64_step() {
+        return emu65x64::legacy.step();
+    }
+
+    bool emu65x64_setJit(bool enable) {
+        return emu65x64::legacy.setJit(enable);
+    }
+
+    unsigned long emu65x64_getCycles() {
+        return emu65x64::legacy.getCycles();
+    }
+
+    bool emu65x64_isStopped() {
+        return emu65x64::legacy.isStopped();
+    }
+
+    void emu65x64_setPc(unsigned long long pc) {
+        emu65x64::legacy.pc = (emu65x64::Qword)pc;
+    }
+
+    unsigned int emu65x64_run(unsigned long long maxCycles, unsigned long long maxInstructions) {
+        return emu65x64::legacy.run(maxCycles, maxInstructions);
+    }
+
+    void emu65x64_setBreakpoint(unsigned long long addr) {
+        emu65x64::legacy.setBreakpoint(addr);
+    }
+
+    void emu65x64_clearBreakpoint(unsigned long long addr) {
+        emu65x64::legacy.clearBreakpoint(addr);
+    }
+
+    void emu65x64_setWatchpoint(unsigned long long base, unsigned long long size, unsigned int kinds) {
+        emu65x64::legacy.setWatchpoint(base, size, kinds);
+    }
+
+    void emu65x64_clearWatchpoint(unsigned long long base, unsigned long long size) {
+        emu65x64::legacy.clearWatchpoint(base, size);
+    }
+
+    unsigned long long emu65x64_getWatchAddr() {
+        return emu65x64::legacy.getWatchAddr();
+    }
+
+    unsigned int emu65x64_getWatchKind() {
+        return emu65x64::legacy.getWatchKind();
+    }
+
+    void emu65x64_interrupt() {
+        emu65x64::legacy.interrupt();
+    }
+
+    void emu65x64_wait() {
+        emu65x64::legacy.wait();
+    }
+
+    void emu65x64_raise(unsigned int lines) {
+        emu65x64::legacy.raise(lines);
+    }
+
+    void emu65x64_lower(unsigned int lines) {
+        emu65x64::legacy.lower(lines);
+    }
+
+    unsigned long long emu65x64_schedule(unsigned long long when, emu65x64::HANDLER handler, void *context) {
+        return emu65x64::legacy.schedule((unsigned long)when, handler, context);
+    }
+
+    bool emu65x64_cancel(unsigned long long id) {
+        return emu65x64::legacy.cancel((unsigned long)id);
+    }
+
+    int emu65x64_snapshot(emu65x64::SNAPSHOT **snapshot) {
+        try {
+            *snapshot = emu65x64::legacy.snapshot();
+            return 0;
+        }
+        catch (...) {
+            return failure();
+        }
+    }
+
+    int emu65x64_restore(const emu65x64::SNAPSHOT *snapshot) {
+        try {
+            emu65x64::legacy.restore(*snapshot);
+            return 0;
+        }
+        catch (...) {
+            return failure();
+        }
+    }
+
+    void emu65x64_freeSnapshot(emu65x64::SNAPSHOT *snapshot) {
+        delete snapshot;
+    }
+
+    bool emu65x64_record(const char *path) {
+        return emu65x64::legacy.record(path);
+    }
+
+    bool emu65x64_replay(const char *path) {
+        return emu65x64::legacy.replay(path);
+    }
+
+    bool emu65x64_stopJournal() {
+        return emu65x64::legacy.stopJournal();
+    }
+
+    bool emu65x64_isReplaying() {
+        return emu65x64::legacy.isReplaying();
+    }
+
+    bool emu65x64_hasDiverged() {
+        return emu65x64::legacy.hasDiverged();
+    }
+
+    bool emu65x64_setHistory(unsigned long interval, unsigned int depth) {
+        return emu65x64::legacy.setHistory(interval, depth);
+    }
+
+    bool emu65x64_reverseStep() {
+        return emu65x64::legacy.reverseStep();
+    }
+
+    bool emu65x64_reverseContinue() {
+        return emu65x64::legacy.reverseContinue();
+    }
+
+    // Handle based wrappers, one independent emulator per handle
+
+    emu65x64 *emu65x64_create() {
+        return new emu65x64();
+    }
+
+    void emu65x64_destroy(emu65x64 *emu) {
+        delete emu;
+    }
+
+    bool emu65x64_setMemoryH(emu65x64 *emu, unsigned long long memMask, unsigned long long ramSize, const unsigned char *pROM) {
+        return emu->setMemory(memMask, ramSize, pROM);
+    }
+
+    void emu65x64_setMemoryRamH(emu65x64 *emu, unsigned long long memMask, unsigned long long ramSize, unsigned char *pRAM, const unsigned char *pROM) {
+        emu->setMemory(memMask, ramSize, pRAM, pROM);
+    }
+
+    void emu65x64_mapRamH(emu65x64 *emu, unsigned long long base, unsigned long long size, unsigned char *pHost) {
+        emu->mapRam(base, size, pHost);
+    }
+
+    void emu65x64_mapRomH(emu65x64 *emu, unsigned long long base, unsigned long long size, const unsigned char *pHost) {
+        emu->mapRom(base, size, pHost);
+    }
+
+    bool emu65x64_mapRomFileH(emu65x64 *emu, unsigned long long base, const char *path) {
+        return emu->mapRomFile(base, path);
+    }
+
+    void emu65x64_unmapH(emu65x64 *emu, unsigned long long base, unsigned long long size) {
+        emu->unmap(base, size);
+    }
+
+    bool emu65x64_mapSparseH(emu65x64 *emu, unsigned long long base, unsigned long long size) {
+        return emu->mapSparse(base, size);
+    }
+
+    void emu65x64_mapMmioH(emu65x64 *emu, unsigned long long base, unsigned long long size) {
+        emu->mapMmio(base, size);
+    }
+
+    void emu65x64_mapDeviceH(emu65x64 *emu, unsigned long long base, unsigned long long size, const mem65x64::DEVICE *device) {
+        emu->mapDevice(base, size, *device);
+    }
+
+    unsigned long long emu65x64_getCommittedH(emu65x64 *emu) {
+        return emu->getCommitted();
+    }
+
+    unsigned long long emu65x64_getHugeCommittedH(emu65x64 *emu) {
+        return emu->getHugeCommitted();
+    }
+
+    unsigned long long emu65x64_getDirtyH(emu65x64 *emu, unsigned long long base, unsigned long long size, unsigned char *bitmap) {
+        return emu->getDirty(base, size, bitmap);
+    }
+
+    void emu65x64_clearDirtyH(emu65x64 *emu, unsigned long long base, unsigned long long size) {
+        emu->clearDirty(base, size);
+    }
+
+    void emu65x64_resetH(emu65x64 *emu, bool trace) {
+        emu->reset(trace);
+    }
+
+    unsigned int emu65x64_stepH(emu65x64 *emu) {
+        return emu->step();
+    }
+
+    bool emu65x64_setJitH(emu65x64 *emu, bool enable) {
+        return emu->setJit(enable);
+    }
+
+    unsigned long emu65x64_getCyclesH(emu65x64 *emu) {
+        return emu->getCycles();
+    }
+
+    bool emu65x64_isStoppedH(emu65x64 *emu) {
+        return emu->isStopped();
+    }
+
+    void emu65x64_setPcH(emu65x64 *emu, unsigned long long pc) {
+        emu->pc = (emu65x64::Qword)pc;
+    }
+
+    unsigned int emu65x64_runH(emu65x64 *emu, unsigned long long maxCycles, unsigned long long maxInstructions) {
+        return emu->run(maxCycles, maxInstructions);
+    }
+
+    void emu65x64_setBreakpointH(emu65x64 *emu, unsigned long long addr) {
+        emu->setBreakpoint(addr);
+    }
+
+    void emu65x64_clearBreakpointH(emu65x64 *emu, unsigned long long addr) {
+        emu->clearBreakpoint(addr);
+    }
+
+    void emu65x64_setWatchpointH(emu65x64 *emu, unsigned long long base, unsigned long long size, unsigned int kinds) {
+        emu->setWatchpoint(base, size, kinds);
+    }
+
+    void emu65x64_clearWatchpointH(emu65x64 *emu, unsigned long long base, unsigned long long size) {
+        emu->clearWatchpoint(base, size);
+    }
+
+    unsigned long long emu65x64_getWatchAddrH(emu65x64 *emu) {
+        return emu->getWatchAddr();
+    }
+
+    unsigned int emu65x64_getWatchKindH(emu65x64 *emu) {
+        return emu->getWatchKind();
+    }
+
+    void emu65x64_interruptH(emu65x64 *emu) {
+        emu->interrupt();
+    }
+
+    void emu65x64_waitH(emu65x64 *emu) {
+        emu->wait();
+    }
+
+    void emu65x64_raiseH(emu65x64 *emu, unsigned int lines) {
+        emu->raise(lines);
+    }
+
+    void emu65x64_lowerH(emu65x64 *emu, unsigned int lines) {
+        emu->lower(lines);
+    }
+
+    unsigned long long emu65x64_scheduleH(emu65x64 *emu, unsigned long long when, emu65x64::HANDLER handler, void *context) {
+        return emu->schedule((unsigned long)when, handler, context);
+    }
+
+    bool emu65x64_cancelH(emu65x64 *emu, unsigned long long id) {
+        return emu->cancel((unsigned long)id);
+    }
+
+    int emu65x64_snapshotH(emu65x64 *emu, emu65x64::SNAPSHOT **snapshot) {
+        try {
+            *snapshot = emu->snapshot();
+            return 0;
+        }
+        catch (...) {
+            return failure();
+        }
+    }
+
+    int emu65x64_restoreH(emu65x64 *emu, const emu65x64::SNAPSHOT *snapshot) {
+        try {
+            emu->restore(*snapshot);
+            return 0;
+        }
+        catch (...) {
+            return failure();
+        }
+    }
+
+    int emu65x64_forkH(const emu65x64::SNAPSHOT *snapshot, emu65x64 **emu) {
+        try {
+            *emu = emu65x64::fork(*snapshot);
+            return 0;
+        }
+        catch (...) {
+            return failure();
+        }
+    }
+
+    bool emu65x64_recordH(emu65x64 *emu, const char *path) {
+        return emu->record(path);
+    }
+
+    bool emu65x64_replayH(emu65x64 *emu, const char *path) {
+        return emu->replay(path);
+    }
+
+    bool emu65x64_stopJournalH(emu65x64 *emu) {
+        return emu->stopJournal();
+    }
+
+    bool emu65x64_isReplayingH(emu65x64 *emu) {
+        return emu->isReplaying();
+    }
+
+    bool emu65x64_hasDivergedH(emu65x64 *emu) {
+        return emu->hasDiverged();
+    }
+
+    bool emu65x64_setHistoryH(emu65x64 *emu, unsigned long interval, unsigned int depth) {
+        return emu->setHistory(interval, depth);
+    }
+
+    bool emu65x64_reverseStepH(emu65x64 *emu) {
+        return emu->reverseStep();
+    }
+
+    bool emu65x64_reverseContinueH(emu65x64 *emu) {
+        return emu->reverseContinue();
+    }
+}
@@ -36,42 +36,134 @@
 #define EMU65X64_H
 
 #include "mem65x64.hpp"
+#include "ops65x64.hpp"
 
 #include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <vector>
 
-#if 1
-# define TRACE(MNEM)    { if (trace) dump(MNEM, ea); }
-# define BYTES(N)       { if (trace) bytes(N); pc += N; }
-# define SHOWPC()       { if (trace) show(); }
-# define ENDL()         { if (trace) cout << endl; }
-#else
-# define TRACE(MNEM)
-# define BYTES(N)       { pc += N; }
-# define SHOWPC()
-# define ENDL()
-#endif
+class jit65x64;
 
 // Defines the NOZOTECH 65x64 emulator.
 class emu65x64 :
     public mem65x64
 {
 public:
-    static void reset(bool trace);
-    static void step();
+    emu65x64();
+    ~emu65x64();
+
+    // Reasons for run() to return
+    enum RESULT {
+        RUN_BUDGET,         // The cycle or instruction budget is used up
+        RUN_STOPPED,        // WDM #$ff has stopped the emulator
+        RUN_HALTED,         // STP or WAI is waiting for an interrupt
+        RUN_BREAKPOINT,     // The next instruction is at a breakpoint
+        RUN_INTERRUPT,      // An interrupt has been raised
+        RUN_WATCHPOINT      // The last instruction accessed a watched address
+    };
+
+    void reset(bool trace);
+
+    // Execute one instruction. While STP/WAI is waiting for an interrupt
+    // nothing is executed and RUN_HALTED is returned at once, so a host that
+    // loops on step() should call wait() rather than spin.
+    RESULT step();
+    RESULT run(unsigned long maxCycles, unsigned long maxInstructions);
+
+    bool setJit(bool enable);
+
+    // Test if hot code is being translated
+    inline bool isJit() const
+    {
+        return (jit != NULL);
+    }
+
+    void setBreakpoint(Addr addr);
+    void clearBreakpoint(Addr addr);
+
+    // Return the address of the access that last stopped run() at a
+    // watchpoint, and whether it was a WATCH_READ or WATCH_WRITE
+    inline Addr getWatchAddr() const
+    {
+        return (watchAddr);
+    }
+
+    inline unsigned int getWatchKind() const
+    {
+        return (watchKind);
+    }
+
+    // Signal an interrupt to STP/WAI and make run() return. May be called
+    // from another thread to wake one blocked in wait(). While replaying only
+    // the journal wakes STP/WAI.
+    inline void interrupt()
+    {
+        std::lock_guard<std::mutex> lock(idle);
+
+        if (!isReplaying())
+            interrupted = true;
+        raised = true;
+        wakeup.notify_all();
+    }
+
+    void wait();
+
+    // Interrupt lines
+    enum {
+        LINE_IRQ        = 1 << 0,       // Level triggered, masked by p.f_i
+        LINE_NMI        = 1 << 1,       // Edge triggered
+        LINE_ABORT      = 1 << 2        // Edge triggered
+    };
+
+    void raise(unsigned int lines);
+
+    // Release interrupt lines, normally the IRQ once its device is serviced.
+    // May be called from another thread.
+    inline void lower(unsigned int lines)
+    {
+        pending.fetch_and(~lines);
+    }
+
+    // Called once the cycle count reaches the time an event was scheduled for
+    typedef void (*HANDLER)(void *context, unsigned long when);
+
+    unsigned long schedule(unsigned long when, HANDLER handler, void *context);
+    bool cancel(unsigned long id);
 
-    inline static unsigned long getCycles()
+    // Log the inputs that make a run non-deterministic, or feed back a log to
+    // repeat the run that recorded it
+    bool record(const char *path);
+    bool replay(const char *path);
+    bool stopJournal();
+
+    // Test if a journal is feeding back its inputs. May be called from
+    // another thread.
+    inline bool isReplaying() const
+    {
+        return (replaying.load(std::memory_order_acquire));
+    }
+
+    // Test if the last replay stopped because the run no longer matched it
+    inline bool hasDiverged() const
+    {
+        return (journal && journal->hasDiverged());
+    }
+
+    inline unsigned long getCycles()
     {
         return (cycles);
     }
 
-    inline static bool isStopped()
+    inline bool isStopped()
     {
         return (stopped);
     }
 
-    static union FLAGS {
+    union FLAGS {
         struct {
             Bit             f_c : 1; // Carry
             Bit             f_z : 1; // Zero
@@ -85,8 +177,14 @@ public:
         Byte            b;
     }   p;
 
-    static Byte      r; // Ring level
-    static Bit      e; // Emulation mode (deprecated)
+    // The N, V, Z and C bits of p are only current after getp(). Handlers
+    // record the values the flags derive from: N, V and C are set when their
+    // word is non-zero and Z when its word is zero.
+    unsigned int    fn, fv, fc;
+    Qword           fz;
+
+    Byte            r; // Ring level
+    Bit             e; // Emulation mode (deprecated)
 
     /**
      * Register set
@@ -101,60 +199,108 @@ public:
      * tp - Task Pointer
      * dp - Direct Page Register
      */
-    static union REGS {
+    union REGS {
         Byte            b;
         Word            w;
         Dword           d;
         Qword           q;
     }   a, b, c, x, y, z, sp, tp, dp;
 
-    static Qword     pc; // Program Counter
-    static Byte     pbr, dbr; // Program and Data Bank Registers (deprecated)
-
-    static bool     stopped; // Indicates the emulator has stopped
-    static bool     interrupted; // Indicates an interrupt has occurred
-    static unsigned long cycles; // Number of cycles executed
-    static bool     trace; // Indicates trace mode is enabled
-
-    emu65x64();
-    ~emu65x64();
-
-    static void show();
-    static void bytes(unsigned int);
-    static void dump_reg(const char *, REGS);
-    static void dump(const char *, Addr);
+    Qword           pc; // Program Counter
+    Byte            pbr, dbr; // Program and Data Bank Registers (deprecated)
+
+    bool            stopped; // Indicates the emulator has stopped
+    std::atomic<bool> interrupted; // Indicates an interrupt has occurred
+    std::atomic<bool> raised; // Indicates an interrupt not yet seen by run()
+    bool            halted; // Indicates STP/WAI is waiting for an interrupt
+    unsigned long   cycles; // Number of cycles executed
+    bool            trace; // Indicates trace mode is enabled
+
+    // The registers of an emulator at one moment
+    struct STATE {
+        REGS            a, b, c, x, y, z, sp, tp, dp;
+        Qword           pc;
+        Byte            p, r, pbr, dbr;
+        Bit             e;
+        bool            stopped;
+        bool            halted;
+        unsigned long   cycles;
+    };
+
+    // The registers and memory of an emulator at one moment. Scheduled
+    // events, breakpoints and interrupt lines are not included.
+    struct SNAPSHOT : STATE {
+        IMAGE           memory;
+    };
+
+    SNAPSHOT *snapshot();
+    void restore(const SNAPSHOT &snapshot);
+    static emu65x64 *fork(const SNAPSHOT &snapshot);
+
+    // Keep a checkpoint every interval cycles, up to depth of them, so that
+    // execution can be taken backwards. An interval of zero stops. Going
+    // forward again replays device reads and drops device writes up to the
+    // cycle the run was taken back from; stores made by the host or by event
+    // handlers are not undone, and interrupt lines keep their live state.
+    bool setHistory(unsigned long interval, unsigned int depth);
+    bool reverseStep();
+    bool reverseContinue();
+
+    // The instance driven by the handle-less ffi entry points
+    static emu65x64 legacy;
+
+    void show();
+    void bytes(Addr, unsigned int);
+    void dump_reg(const char *, REGS);
+    void dump(const char *, Addr);
 
     // Push a byte on the stack
-    inline static void pushByte(Byte value)
+    inline void pushByte(Byte value)
     {
         setByte(sp.q, value);
 
         --sp.q;
     }
 
+    // Wider values are moved in one access. The stack grows down, so a value
+    // pushed a byte at a time from its top byte down would be left stored
+    // little-endian just below sp, and it is pulled from just above.
+
     // Push a word on the stack
-    inline static void pushWord(Word value)
+    inline void pushWord(Word value)
     {
-        pushByte(hi_b(value));
-        pushByte(lo_b(value));
+        setWord(sp.q - 1, value);
+
+        sp.q -= 2;
     }
 
     // Push a dword on the stack
-    inline static void pushDword(Dword value)
+    inline void pushDword(Dword value)
     {
-        pushWord(hi_w(value));
-        pushWord(lo_w(value));
+        setDword(sp.q - 3, value);
+
+        sp.q -= 4;
     }
 
     // Push a qword on the stack
-    inline static void pushQword(Qword value)
+    inline void pushQword(Qword value)
     {
-        pushDword(hi_d(value));
-        pushDword(lo_d(value));
+        setQword(sp.q - 7, value);
+
+        sp.q -= 8;
+    }
+
+    // Push the return address and then the status of an interrupt frame
+    inline void pushFrame(Qword addr, Byte flags)
+    {
+        setQword(sp.q - 7, addr);
+        setByte(sp.q - 8, flags);
+
+        sp.q -= 9;
     }
 
     // Pull a byte from the stack
-    inline static Byte pullByte()
+    inline Byte pullByte()
     {
         ++sp.q;
 
@@ -162,159 +308,344 @@ public:
     }
 
     // Pull a word from the stack
-    inline static Word pullWord()
+    inline Word pullWord()
     {
-        register Byte   l = pullByte();
-        register Byte   h = pullByte();
+        register Word   value = getWord(sp.q + 1);
 
-        return (join_w(l, h));
+        sp.q += 2;
+        return (value);
     }
 
     // Pull a dword from the stack
-    inline static Dword pullDword()
+    inline Dword pullDword()
     {
-        register Word   l = pullWord();
-        register Word   h = pullWord();
+        register Dword  value = getDword(sp.q + 1);
 
-        return (join_d(l, h));
+        sp.q += 4;
+        return (value);
     }
 
     // Pull a qword from the stack
-    inline static Qword pullQword()
+    inline Qword pullQword()
+    {
+        register Qword  value = getQword(sp.q + 1);
+
+        sp.q += 8;
+        return (value);
+    }
+
+    // Pull the status and then the return address of an interrupt frame
+    inline Byte pullFrame(Qword &addr)
     {
-        register Dword  l = pullDword();
-        register Dword  h = pullDword();
+        register Byte   flags = getByte(sp.q + 1);
 
-        return (join_q(l, h));
+        addr = getQword(sp.q + 2);
+        sp.q += 9;
+        return (flags);
     }
 
 private:
+    // Opcode table entry, generated from ops65x64.hpp
+    struct OPCODE {
+        const char     *mnem;   // Trace mnemonic
+        Byte            length; // Instruction length in bytes
+        Byte            cycles; // Base cycle count
+        Byte            operand; // Operand bytes read by the addressing mode
+    };
+
+    static const OPCODE opcodes[256];
+
+    // Operand bytes each addressing mode reads from the instruction stream.
+    // Immediate modes return the operand address so they latch nothing.
+    enum {
+        OPERAND_impl    = 0,
+        OPERAND_acc     = 0,
+        OPERAND_immb    = 0,
+        OPERAND_immw    = 0,
+        OPERAND_immd    = 0,
+        OPERAND_immq    = 0,
+        OPERAND_rela    = 2,
+        OPERAND_srel    = 2,
+        OPERAND_srix    = 2,
+        OPERAND_sriy    = 2,
+        OPERAND_sriz    = 2,
+        OPERAND_lrel    = 4,
+        OPERAND_dpag    = 4,
+        OPERAND_dpgx    = 4,
+        OPERAND_dpgy    = 4,
+        OPERAND_dpgz    = 4,
+        OPERAND_dpgi    = 4,
+        OPERAND_dpxi    = 4,
+        OPERAND_dpyi    = 4,
+        OPERAND_dpzi    = 4,
+        OPERAND_dpix    = 4,
+        OPERAND_dpiy    = 4,
+        OPERAND_dpiz    = 4,
+        OPERAND_absl    = 8,
+        OPERAND_absx    = 8,
+        OPERAND_absy    = 8,
+        OPERAND_absz    = 8,
+        OPERAND_absi    = 8,
+        OPERAND_abxi    = 8,
+        OPERAND_abyi    = 8,
+        OPERAND_abzi    = 8
+    };
+
+    // Most bytes MVN or MVP moves before running again
+    enum {
+        MOVE_CHUNK      = 4096
+    };
+
+    // Decoded instruction cache geometry
+    enum {
+        DECODE_BITS     = 11,
+        DECODE_SIZE     = 1 << DECODE_BITS,
+        DECODE_MASK     = DECODE_SIZE - 1
+    };
+
+    // A decoded instruction, indexed by the low bits of its address. An empty
+    // entry is tagged with an address that cannot map to it.
+    struct DECODED {
+        Addr            pc;     // Address of the opcode
+        Addr            at;     // Resolved address of the opcode
+        Qword           operand; // Operand bytes after the opcode
+        Byte            opcode; // The opcode
+    };
+
+    DECODED         decoded[DECODE_SIZE]; // Recently executed instructions
+    Qword           operand; // Operand of the current instruction
+
+    // Fetch the opcode at pc and latch its operand, skipping the memory
+    // accesses when the instruction has been decoded before
+    inline Byte fetch()
+    {
+        DECODED &entry = decoded[pc & DECODE_MASK];
+
+        if (entry.pc != pc)
+            decode(entry, pc);
+
+        operand = entry.operand;
+        ++pc;
+        return (entry.opcode);
+    }
+
+    bool decode(DECODED &entry, Addr addr);
+    void codeChanged(Addr first, Addr last);
+    void watchHit(Addr ea, unsigned int size, unsigned int kind);
+
+    bool            fetching; // Reads are of code, not data
+    bool            watched; // A watchpoint was hit by the last instruction
+    Addr            watchAddr; // Address of the access that hit it
+    unsigned int    watchKind; // Kind of the access
+
+    jit65x64       *jit; // Translator for hot code, if enabled
+
+    RESULT resume(unsigned long limit, unsigned long &count);
+    template <bool TRACED> RESULT execute(unsigned long &budget);
+    RESULT finish();
+
+    // The translator runs the interpreter's state and handlers directly
+    friend class jit65x64;
+
+    std::vector<Addr> breakpoints; // Sorted breakpoint addresses
+
+    // An event waiting for the cycle count to reach when
+    struct EVENT {
+        unsigned long   when;   // Cycle to run the handler at
+        unsigned long   id;     // Order of scheduling, for cancel()
+        HANDLER         handler;
+        void           *context;
+    };
+
+    std::vector<EVENT> events; // Pending events as a heap, earliest first
+    unsigned long   deadline; // When the earliest event is due, or ~0
+    unsigned long   scheduled; // Number of events ever scheduled
+    unsigned long   until;  // When the batch being executed must stop
+
+    static bool later(const EVENT &l, const EVENT &r);
+
+    void fire();
+
+    std::mutex      idle; // Guards the wakeup of a halted emulator
+    std::condition_variable wakeup; // Signalled by interrupt()
+
+    bool sleep(unsigned long limit);
+
+    std::atomic<unsigned int> pending; // Interrupt lines raised
+    std::atomic<bool> replaying; // Set by the journal while it feeds back inputs
+    unsigned int    masked; // Interrupt lines p.f_i is holding off
+
+    // Test if an interrupt line needs servicing. A replay takes its
+    // interrupts from the journal instead.
+    inline bool isPending() const
+    {
+        return ((pending.load(std::memory_order_relaxed) & ~masked) != 0 &&
+            !replaying.load(std::memory_order_relaxed));
+    }
+
+    void service();
+    void enter(unsigned int line);
+
+    void replayDue();
+    Byte input();
+
+    void save(STATE &state);
+    void load(const STATE &state);
+
+    // The registers and the undo log of memory at a point in the history
+    struct CHECKPOINT {
+        STATE           state;
+        UNDO            changes;  // Pages stored to before the next one
+        size_t          position; // Where the kept journal had reached
+        unsigned long   stamp;    // Cycle of the journal entry before it
+        unsigned long   layout;   // The memory map it was taken in
+    };
+
+    std::vector<CHECKPOINT> history; // Checkpoints, oldest first
+    unsigned long   interval; // Cycles between checkpoints, or 0
+    unsigned int    depth; // Most checkpoints kept
+    unsigned long   due; // When the next checkpoint is taken, or ~0
+
+    void checkpoint();
+    size_t latest(unsigned long before) const;
+    void rewind(size_t index);
+    RESULT forward(unsigned long limit, unsigned long &count);
+
+    // Log that an interrupt ended STP/WAI, or kept it from waiting
+    inline void woke()
+    {
+        if (journal && journal->isRecording())
+            journal->put(journal65x64::ENTRY_WAKE, 0);
+    }
+
+    bool isBreakpoint(Addr addr) const;
+
     // Absolute - a
-    inline static Addr am_absl()
+    inline Addr am_absl()
     {
-        Addr ea = getQword(pc);
+        Addr ea = operand;
 
-        BYTES(8);
+        pc += 8;
         cycles += 2; // TODO: fix cycles
         return (ea);
     }
 
     // Absolute Indexed X - a,X
-    inline static Addr am_absx()
+    inline Addr am_absx()
     {
-        register Addr   ea = getQword(pc) + x.q;
+        register Addr   ea = operand + x.q;
 
-        BYTES(8);
+        pc += 8;
         cycles += 2; // TODO: fix cycles
         return (ea);
     }
 
     // Absolute Indexed Y - a,Y
-    inline static Addr am_absy()
+    inline Addr am_absy()
     {
-        register Addr   ea = getQword(pc) + y.q;
+        register Addr   ea = operand + y.q;
 
-        BYTES(8);
+        pc += 8;
         cycles += 2; // TODO: fix cycles
         return (ea);
     }
 
     // Absolute Indexed Z - a,Z
-    inline static Addr am_absz()
+    inline Addr am_absz()
     {
-        register Addr   ea = getQword(pc) + z.q;
+        register Addr   ea = operand + z.q;
 
-        BYTES(8);
+        pc += 8;
         cycles += 2; // TODO: fix cycles
         return (ea);
     }
 
     // Absolute Indirect - (a)
-    inline static Addr am_absi()
+    inline Addr am_absi()
     {
-        register Addr ia = getQword(pc);
+        register Addr ia = operand;
 
-        BYTES(8);
+        pc += 8;
         cycles += 4; // TODO: fix cycles
         return (getQword(ia));
     }
 
     // Absolute Indexed Indirect X - (a,X)
-    inline static Addr am_abxi()
+    inline Addr am_abxi()
     {
-        register Addr ia = getQword(pc) + x.q;
+        register Addr ia = operand + x.q;
 
-        BYTES(2);
+        pc += 2;
         cycles += 4; // TODO: fix cycles
         return (getQword(ia));
     }
 
     // Absolute Indexed Indirect Y - (a,Y)
-    inline static Addr am_abyi()
+    inline Addr am_abyi()
     {
-        register Addr ia = getQword(pc) + y.q;
+        register Addr ia = operand + y.q;
 
-        BYTES(2);
+        pc += 2;
         cycles += 4; // TODO: fix cycles
         return (getQword(ia));
     }
 
     // Absolute Indexed Indirect Z - (a,Z)
-    inline static Addr am_abzi()
+    inline Addr am_abzi()
     {
-        register Addr ia = getQword(pc) + z.q;
+        register Addr ia = operand + z.q;
 
-        BYTES(2);
+        pc += 2;
         cycles += 4; // TODO: fix cycles
         return (getQword(ia));
     }
 
     // Absolute Long - >a
     /*
-    inline static Addr am_alng()
+    inline Addr am_alng()
     {
         Addr ea = getAddr(join_w(pbr, pc));
 
-        BYTES(3);
+        pc += 3;
         cycles += 3; // TODO: fix cycles
         return (ea);
     }
 
     // Absolute Long Indexed - >a,X
-    inline static Addr am_alnx()
+    inline Addr am_alnx()
     {
         register Addr ea = getAddr(join_w(pbr, pc)) + x.w;
 
-        BYTES(3);
+        pc += 3;
         cycles += 3; // TODO: fix cycles
         return (ea);
     }
 
     // Absolute Indirect Long - [a]
-    inline static Addr am_abil()
+    inline Addr am_abil()
     {
         register Addr ia = bank(0) | getWord(join_w(pbr, pc));
 
-        BYTES(2);
+        pc += 2;
         cycles += 5; // TODO: fix cycles
         return (getAddr(ia));
     }
     */
 
     // Direct Page - d
-    inline static Addr am_dpag()
+    inline Addr am_dpag()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
-        BYTES(4);
+        pc += 4;
         cycles += 1; // TODO: fix cycles
         return (Qword)(dp.q + offset);
     }
 
     // Direct Page Indexed X - d,X
-    inline static Addr am_dpgx()
+    inline Addr am_dpgx()
     {
-        Dword offset = getDword(pc) + x.d;
+        Dword offset = (Dword)operand + x.d;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -322,15 +653,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 1; // TODO: fix cycles
         return (Qword)(dp.q + offset);
     }
 
     // Direct Page Indexed Y - d,Y
-    inline static Addr am_dpgy()
+    inline Addr am_dpgy()
     {
-        Dword offset = getDword(pc) + y.d;
+        Dword offset = (Dword)operand + y.d;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -338,15 +669,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 1; // TODO: fix cycles
         return (Qword)(dp.q + offset);
     }
 
     // Direct Page Indexed Z - d,Z
-    inline static Addr am_dpgz()
+    inline Addr am_dpgz()
     {
-        Dword offset = getDword(pc) + z.d;
+        Dword offset = (Dword)operand + z.d;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -354,15 +685,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 1; // TODO: fix cycles
         return (Qword)(dp.q + offset);
     }
 
     // Direct Page Indirect - (d)
-    inline static Addr am_dpgi()
+    inline Addr am_dpgi()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -370,15 +701,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (Qword)(getQword(dp.q + offset));
     }
 
     // Direct Page Indexed Indirect X - (d,x)
-    inline static Addr am_dpxi()
+    inline Addr am_dpxi()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -386,15 +717,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (Qword)(dp.q + offset + x.q);
     }
 
     // Direct Page Indexed Indirect Y - (d,y)
-    inline static Addr am_dpyi()
+    inline Addr am_dpyi()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -402,15 +733,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (Qword)(dp.q + offset + y.q);
     }
 
     // Direct Page Indexed Indirect Z - (d,z)
-    inline static Addr am_dpzi()
+    inline Addr am_dpzi()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -418,15 +749,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (Qword)(dp.q + offset + z.q);
     }
 
     // Direct Page Indirect Indexed X - (d),X
-    inline static Addr am_dpix()
+    inline Addr am_dpix()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -434,15 +765,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (getQword((Qword)(dp.q + offset)) + x.q);
     }
 
     // Direct Page Indirect Indexed Y - (d),Y
-    inline static Addr am_dpiy()
+    inline Addr am_dpiy()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -450,15 +781,15 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (getQword((Qword)(dp.q + offset)) + y.q);
     }
 
     // Direct Page Indirect Indexed Z - (d),Z
-    inline static Addr am_dpiz()
+    inline Addr am_dpiz()
     {
-        Dword offset = getDword(pc);
+        Dword offset = (Dword)operand;
 
         // Without this masking, this addressing mode can be exploited to
         // do segment arithmetic. Haven't decided if this is a feature or
@@ -466,133 +797,133 @@ private:
         // TODO: revisit this.
         // offset &= 0xfff; // Mask to 12-bits
 
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
         return (getQword((Qword)(dp.q + offset)) + z.q);
     }
 
     /*
     // Direct Page Indirect Long - [d]
-    inline static Addr am_dpil()
+    inline Addr am_dpil()
     {
         Byte disp = getByte(join_w(pbr, pc));
 
-        BYTES(1);
+        pc += 1;
         cycles += 4; // TODO: fix cycles
         return (getAddr(bank(0) | (Word)(dp.w + disp)));
     }
 
     // Direct Page Indirect Long Indexed - [d],Y
-    inline static Addr am_dily()
+    inline Addr am_dily()
     {
         Byte disp = getByte(join_w(pbr, pc));
 
-        BYTES(1);
+        pc += 1;
         cycles += 4; // TODO: fix cycles
         return (getAddr(bank(0) | (Word)(dp.w + disp)) + y.w);
     }
     */
 
     // Implied/Stack
-    inline static Addr am_impl()
+    inline Addr am_impl()
     {
-        BYTES(0);
+        pc += 0;
         return (0);
     }
 
     // Accumulator
-    inline static Addr am_acc()
+    inline Addr am_acc()
     {
-        BYTES(0);
+        pc += 0;
         return (0);
     }
 
     // Immediate Byte
-    inline static Addr am_immb()
+    inline Addr am_immb()
     {
         Addr ea = pc;
-        BYTES(1);
+        pc += 1;
         cycles += 0; // TODO: fix cycles
         return (ea);
     }
 
     // Immediate Word
-    inline static Addr am_immw()
+    inline Addr am_immw()
     {
         Addr ea = pc;
-        BYTES(2);
+        pc += 2;
         cycles += 1; // TODO: fix cycles
         return (ea);
     }
 
     // Immediate Dword
-    inline static Addr am_immd()
+    inline Addr am_immd()
     {
         Addr ea = pc;
-        BYTES(4);
+        pc += 4;
         cycles += 3; // TODO: fix cycles
-        return (pc);
+        return (ea);
     }
 
     // Immediate Qword
-    inline static Addr am_immq()
+    inline Addr am_immq()
     {
         Addr ea = pc;
-        BYTES(8);
+        pc += 8;
         cycles += 7; // TODO: fix cycles
         return (ea);
     }
 
     /*
     // Immediate based on size of A/M
-    inline static Addr am_immm()
+    inline Addr am_immm()
     {
         Addr ea = join_w (pbr, pc);
         unsigned int size = (e || p.f_m) ? 1 : 2;
 
-        BYTES(size);
+        pc += size;
         cycles += size - 1; // TODO: fix cycles
         return (ea);
     }
 
     // Immediate based on size of X/Y
-    inline static Addr am_immx()
+    inline Addr am_immx()
     {
         Addr ea = join_w(pbr, pc);
         unsigned int size = (e || p.f_x) ? 1 : 2;
 
-        BYTES(size);
+        pc += size;
         cycles += size - 1; // TODO: fix cycles
         return (ea);
     }
     */
 
     // Long Relative - d (signed 32 bit displacement, from -2147483648 to +2147483647)
-    inline static Addr am_lrel()
+    inline Addr am_lrel()
     {
-        Dword disp = getDword(pc);
+        Dword disp = (Dword)operand;
 
-        BYTES(4);
+        pc += 4;
         cycles += 2; // TODO: fix cycles
         return (Qword)(pc + (signed long)disp);
     }
 
     // Relative - d (signed 16 bit displacement, from -32768 to +32767)
-    inline static Addr am_rela()
+    inline Addr am_rela()
     {
-        Word disp = getWord(pc);
+        Word disp = (Word)operand;
 
-        BYTES(2);
+        pc += 2;
         cycles += 1; // TODO: fix cycles
         return (Qword)(pc + (signed short)disp);
     }
 
     // Stack Relative - d,S (signed 16 bit displacement, from -32768 to +32767)
-    inline static Addr am_srel()
+    inline Addr am_srel()
     {
-        Word disp = getWord(pc);
+        Word disp = (Word)operand;
 
-        BYTES(2);
+        pc += 2;
         cycles += 1; // TODO: fix cycles
 
         /*
@@ -606,12 +937,12 @@ private:
     }
 
     // Stack Relative Indirect Indexed X - (d,S),X (signed 16 bit displacement, from -32768 to +32767)
-    inline static Addr am_srix()
+    inline Addr am_srix()
     {
-        Word disp = getWord(pc);
+        Word disp = (Word)operand;
         register Qword ia;
 
-        BYTES(2);
+        pc += 2;
         cycles += 3; // TODO: fix cycles
 
         ia = getQword((Qword)(sp.q + (signed short)disp));
@@ -620,12 +951,12 @@ private:
     }
 
     // Stack Relative Indirect Indexed Y - (d,S),Y (signed 16 bit displacement, from -32768 to +32767)
-    inline static Addr am_sriy()
+    inline Addr am_sriy()
     {
-        Word disp = getWord(pc);
+        Word disp = (Word)operand;
         register Qword ia;
 
-        BYTES(2);
+        pc += 2;
         cycles += 3; // TODO: fix cycles
 
         /*
@@ -643,12 +974,12 @@ private:
     }
 
     // Stack Relative Indirect Indexed Z - (d,S),Z (signed 16 bit displacement, from -32768 to +32767)
-    inline static Addr am_sriz()
+    inline Addr am_sriz()
     {
-        Word disp = getWord(pc);
+        Word disp = (Word)operand;
         register Qword ia;
 
-        BYTES(2);
+        pc += 2;
         cycles += 3; // TODO: fix cycles
 
         ia = getQword((Qword)(sp.q + (signed short)disp));
@@ -657,76 +988,121 @@ private:
     }
 
     // Set the Negative flag
-    inline static void setn(unsigned int flag)
+    inline void setn(unsigned int flag)
     {
-        p.f_n = flag ? 1 : 0;
+        fn = flag;
     }
 
     // Set the Overflow flag
-    inline static void setv(unsigned int flag)
+    inline void setv(unsigned int flag)
     {
-        p.f_v = flag ? 1 : 0;
+        fv = flag;
     }
 
     // Set the decimal flag
-    inline static void setd(unsigned int flag)
+    inline void setd(unsigned int flag)
     {
         p.f_d = flag ? 1 : 0;
     }
 
     // Set the Interrupt Disable flag
-    inline static void seti(unsigned int flag)
+    inline void seti(unsigned int flag)
     {
         p.f_i = flag ? 1 : 0;
+        masked = p.f_i ? LINE_IRQ : 0;
     }
 
     // Set the Zero flag
-    inline static void setz(unsigned int flag)
+    inline void setz(unsigned int flag)
     {
-        p.f_z = flag ? 1 : 0;
+        fz = flag ? 0 : 1;
     }
 
     // Set the Carry flag
-    inline static void setc(unsigned int flag)
+    inline void setc(unsigned int flag)
     {
-        p.f_c = flag ? 1 : 0;
+        fc = flag;
     }
 
     // Set the Negative and Zero flags from a byte value
-    inline static void setnz_b(Byte value)
+    inline void setnz_b(Byte value)
     {
         setn(value & 0x80);
-        setz(value == 0);
+        fz = value;
     }
 
     // Set the Negative and Zero flags from a word value
-    inline static void setnz_w(Word value)
+    inline void setnz_w(Word value)
     {
         setn(value & 0x8000);
-        setz(value == 0);
+        fz = value;
     }
 
     // Set the Negative and Zero flags from a dword value
-    inline static void setnz_d(Dword value)
+    inline void setnz_d(Dword value)
     {
         setn(value & 0x80000000);
-        setz(value == 0);
+        fz = value;
     }
 
     // Set the Negative and Zero flags from a qword value
-    inline static void setnz_q(Qword value)
+    inline void setnz_q(Qword value)
+    {
+        setn(value >> 63);
+        fz = value;
+    }
+
+    // Test the Negative flag
+    inline bool flagn() const
+    {
+        return (fn != 0);
+    }
+
+    // Test the Overflow flag
+    inline bool flagv() const
+    {
+        return (fv != 0);
+    }
+
+    // Test the Zero flag
+    inline bool flagz() const
+    {
+        return (fz == 0);
+    }
+
+    // Test the Carry flag
+    inline bool flagc() const
+    {
+        return (fc != 0);
+    }
+
+    // Fold the lazy flags into p and return it
+    inline Byte getp()
+    {
+        p.f_n = flagn();
+        p.f_v = flagv();
+        p.f_z = flagz();
+        p.f_c = flagc();
+        return (p.b);
+    }
+
+    // Load p and the lazy flags from a byte
+    inline void setp(Byte value)
     {
-        setn(value & 0x8000000000000000);
-        setz(value == 0);
+        p.b = value;
+        fn = p.f_n;
+        fv = p.f_v;
+        fz = !p.f_z;
+        fc = p.f_c;
+        masked = p.f_i ? LINE_IRQ : 0;
     }
 
-    inline static void op_adc(Addr ea)
+    inline void op_adc(Addr ea)
     {
-        TRACE("ADC");
         /*
         if (e || p.f_m) {
             Byte    data = getByte(ea);
-            Word    temp = a.b + data + p.f_c;
+            Word    temp = a.b + data + flagc();
 
             if (p.f_d) {
                 if ((temp & 0x0f) > 0x09) temp += 0x06;
@@ -740,7 +1116,7 @@ private:
         }
         else {
             Word    data = getWord(ea);
-            int     temp = a.w + data + p.f_c;
+            int     temp = a.w + data + flagc();
 
             if (p.f_d) {
                 if ((temp & 0x000f) > 0x0009) temp += 0x0006;
@@ -757,40 +1133,26 @@ private:
         */
 
         Qword data = getQword(ea);
-        Qword temp = 0, temph = 0, templ = 0;
-        temph = hi_d(a.q) + hi_d(data);
-        templ = lo_d(a.q) + lo_d(data) + p.f_c;
+        Qword temp;
+        bool carry = flagc();
 
         if (p.f_d) {
-            if ((templ & 0x0000000f) > 0x00000009) templ += 0x00000006;
-            if ((templ & 0x000000f0) > 0x00000090) templ += 0x00000060;
-            if ((templ & 0x00000f00) > 0x00000900) templ += 0x00000600;
-            if ((templ & 0x0000f000) > 0x00009000) templ += 0x00006000;
-            if ((templ & 0x000f0000) > 0x00090000) templ += 0x00060000;
-            if ((templ & 0x00f00000) > 0x00900000) templ += 0x00600000;
-            if ((templ & 0x0f000000) > 0x09000000) templ += 0x06000000;
-            if ((templ & 0xf0000000) > 0x90000000) templ += 0x60000000;
-
-            if ((temph & 0x0000000f) > 0x00000009) temph += 0x00000006;
-            if ((temph & 0x000000f0) > 0x00000090) temph += 0x00000060;
-            if ((temph & 0x00000f00) > 0x00000900) temph += 0x00000600;
-            if ((temph & 0x0000f000) > 0x00009000) temph += 0x00006000;
-            if ((temph & 0x000f0000) > 0x00090000) temph += 0x00060000;
-            if ((temph & 0x00f00000) > 0x00900000) temph += 0x00600000;
-            if ((temph & 0x0f000000) > 0x09000000) temph += 0x06000000;
-            if ((temph & 0xf0000000) > 0x90000000) temph += 0x60000000;
-        }
-
-        setc(temph & 0x100000000);
-        temp = join_q((Dword)templ, (Dword)temph);
-        setv((~(a.q ^ data)) & (a.q ^ temp) & 0x800000000000000);
+            temp = add_bcd(a.q, data, carry);
+            setv(overflow_bcd(a.q, data, temp));
+        }
+        else {
+            temp = a.q + data + carry;
+            carry = (temp < a.q) || (carry && temp == a.q);
+            setv(((~(a.q ^ data)) & (a.q ^ temp)) >> 63);
+        }
+
+        setc(carry);
         setnz_q(a.q = temp);
         cycles += 2; // TODO: fix cycles
     }
 
-    inline static void op_and(Addr ea)
+    inline void op_and(Addr ea)
     {
-        TRACE("AND");
         /*
         if (e || p.f_m) {
             setnz_b(a.b &= getByte(ea));
@@ -806,10 +1168,8 @@ private:
         cycles += 3; // TODO: fix cycles
     }
 
-    inline static void op_asl(Addr ea)
+    inline void op_asl(Addr ea)
     {
-        TRACE("ASL");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -828,10 +1188,8 @@ private:
         }
     }
 
-    inline static void op_asla(Addr ea)
+    inline void op_asla(Addr ea)
     {
-        TRACE("ASL");
-
         if (e || p.f_m) {
             setc(a.b & 0x80);
             setnz_b(a.b <<= 1);
@@ -845,11 +1203,9 @@ private:
         cycles += 2;
     }
 
-    inline static void op_bcc(Addr ea)
+    inline void op_bcc(Addr ea)
     {
-        TRACE("BCC");
-
-        if (p.f_c == 0) {
+        if (!flagc()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -858,11 +1214,9 @@ private:
             cycles += 2;
     }
 
-    inline static void op_bcs(Addr ea)
+    inline void op_bcs(Addr ea)
     {
-        TRACE("BCS");
-
-        if (p.f_c == 1) {
+        if (flagc()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -871,11 +1225,9 @@ private:
             cycles += 2;
     }
 
-    inline static void op_beq(Addr ea)
+    inline void op_beq(Addr ea)
     {
-        TRACE("BEQ");
-
-        if (p.f_z == 1) {
+        if (flagz()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -884,10 +1236,8 @@ private:
             cycles += 2;
     }
 
-    inline static void op_bit(Addr ea)
+    inline void op_bit(Addr ea)
     {
-        TRACE("BIT");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -907,10 +1257,8 @@ private:
         }
     }
 
-    inline static void op_biti(Addr ea)
+    inline void op_biti(Addr ea)
     {
-        TRACE("BIT");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -924,11 +1272,9 @@ private:
         cycles += 2;
     }
 
-    inline static void op_bmi(Addr ea)
+    inline void op_bmi(Addr ea)
     {
-        TRACE("BMI");
-
-        if (p.f_n == 1) {
+        if (flagn()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -937,11 +1283,9 @@ private:
             cycles += 2;
     }
 
-    inline static void op_bne(Addr ea)
+    inline void op_bne(Addr ea)
     {
-        TRACE("BNE");
-
-        if (p.f_z == 0) {
+        if (!flagz()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -950,11 +1294,9 @@ private:
             cycles += 2;
     }
 
-    inline static void op_bpl(Addr ea)
+    inline void op_bpl(Addr ea)
     {
-        TRACE("BPL");
-
-        if (p.f_n == 0) {
+        if (!flagn()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -963,23 +1305,19 @@ private:
             cycles += 2;
     }
 
-    inline static void op_bra(Addr ea)
+    inline void op_bra(Addr ea)
     {
-        TRACE("BRA");
-
         if (e && ((pc ^ ea) & 0xff00)) ++cycles;
         pc = (Word)ea;
         cycles += 3;
     }
 
-    inline static void op_brk(Addr ea)
+    inline void op_brk(Addr)
     {
-        TRACE("BRK");
-
         /*
         if (e) {
             pushWord(pc);
-            pushByte(p.b | 0x10);
+            pushByte(getp() | 0x10);
 
             p.f_i = 1;
             p.f_d = 0;
@@ -991,7 +1329,7 @@ private:
         else {
             pushByte(pbr);
             pushWord(pc);
-            pushByte(p.b);
+            pushByte(getp());
 
             p.f_i = 1;
             p.f_d = 0;
@@ -1002,29 +1340,24 @@ private:
         }
         */
 
-        pushQword(pc);
-        pushByte(p.b);
+        pushFrame(pc, getp());
 
-        p.f_i = 1;
+        seti(1);
         p.f_d = 0;
 
         pc = getQword(0x3fffffd8);
         cycles += 8; // TODO: fix cycles
     }
 
-    inline static void op_brl(Addr ea)
+    inline void op_brl(Addr ea)
     {
-        TRACE("BRL");
-
         pc = (Word)ea;
         cycles += 3;
     }
 
-    inline static void op_bvc(Addr ea)
+    inline void op_bvc(Addr ea)
     {
-        TRACE("BVC");
-
-        if (p.f_v == 0) {
+        if (!flagv()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -1033,11 +1366,9 @@ private:
             cycles += 2;
     }
 
-    inline static void op_bvs(Addr ea)
+    inline void op_bvs(Addr ea)
     {
-        TRACE("BVS");
-
-        if (p.f_v == 1) {
+        if (flagv()) {
             if (e && ((pc ^ ea) & 0xff00)) ++cycles;
             pc = (Word)ea;
             cycles += 3;
@@ -1046,42 +1377,32 @@ private:
             cycles += 2;
     }
 
-    inline static void op_clc(Addr ea)
+    inline void op_clc(Addr)
     {
-        TRACE("CLC");
-
         setc(0);
         cycles += 2;
     }
 
-    inline static void op_cld(Addr ea)
+    inline void op_cld(Addr)
     {
-        TRACE("CLD")
-
         setd(0);
         cycles += 2;
     }
 
-    inline static void op_cli(Addr ea)
+    inline void op_cli(Addr)
     {
-        TRACE("CLI")
-
         seti(0);
         cycles += 2;
     }
 
-    inline static void op_clv(Addr ea)
+    inline void op_clv(Addr)
     {
-        TRACE("CLD")
-
         setv(0);
         cycles += 2;
     }
 
-    inline static void op_cmp(Addr ea)
+    inline void op_cmp(Addr ea)
     {
-        TRACE("CMP");
-
         if (e || p.f_m) {
             Byte    data = getByte(ea);
             Word    temp = a.b - data;
@@ -1100,15 +1421,13 @@ private:
         }
     }
 
-    inline static void op_cop(Addr ea)
+    inline void op_cop(Addr)
     {
-        TRACE("COP");
-
         if (e) {
             pushWord(pc);
-            pushByte(p.b);
+            pushByte(getp());
 
-            p.f_i = 1;
+            seti(1);
             p.f_d = 0;
             pbr = 0;
 
@@ -1118,9 +1437,9 @@ private:
         else {
             pushByte(pbr);
             pushWord(pc);
-            pushByte(p.b);
+            pushByte(getp());
 
-            p.f_i = 1;
+            seti(1);
             p.f_d = 0;
             pbr = 0;
 
@@ -1129,10 +1448,8 @@ private:
         }
     }
 
-    inline static void op_cpx(Addr ea)
+    inline void op_cpx(Addr ea)
     {
-        TRACE("CPX");
-
         if (e || p.f_x) {
             Byte    data = getByte(ea);
             Word    temp = x.b - data;
@@ -1151,10 +1468,8 @@ private:
         }
     }
 
-    inline static void op_cpy(Addr ea)
+    inline void op_cpy(Addr ea)
     {
-        TRACE("CPY");
-
         if (e || p.f_x) {
             Byte    data = getByte(ea);
             Word    temp = y.b - data;
@@ -1173,10 +1488,8 @@ private:
         }
     }
 
-    inline static void op_dec(Addr ea)
+    inline void op_dec(Addr ea)
     {
-        TRACE("DEC");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -1193,10 +1506,8 @@ private:
         }
     }
 
-    inline static void op_deca(Addr ea)
+    inline void op_deca(Addr)
     {
-        TRACE("DEC");
-
         if (e || p.f_m)
             setnz_b(--a.b);
         else
@@ -1205,10 +1516,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_dex(Addr ea)
+    inline void op_dex(Addr)
     {
-        TRACE("DEX");
-
         if (e || p.f_x)
             setnz_b(x.b -= 1);
         else
@@ -1217,10 +1526,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_dey(Addr ea)
+    inline void op_dey(Addr)
     {
-        TRACE("DEY");
-
         if (e || p.f_x)
             setnz_b(y.b -= 1);
         else
@@ -1229,10 +1536,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_eor(Addr ea)
+    inline void op_eor(Addr ea)
     {
-        TRACE("EOR");
-
         if (e || p.f_m) {
             setnz_b(a.b ^= getByte(ea));
             cycles += 2;
@@ -1243,10 +1548,8 @@ private:
         }
     }
 
-    inline static void op_inc(Addr ea)
+    inline void op_inc(Addr ea)
     {
-        TRACE("INC");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -1263,10 +1566,8 @@ private:
         }
     }
 
-    inline static void op_inca(Addr ea)
+    inline void op_inca(Addr)
     {
-        TRACE("INC");
-
         if (e || p.f_m)
             setnz_b(++a.b);
         else
@@ -1275,10 +1576,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_inx(Addr ea)
+    inline void op_inx(Addr)
     {
-        TRACE("INX");
-
         if (e || p.f_x)
             setnz_b(++x.b);
         else
@@ -1287,10 +1586,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_iny(Addr ea)
+    inline void op_iny(Addr)
     {
-        TRACE("INY");
-
         if (e || p.f_x)
             setnz_b(++y.b);
         else
@@ -1299,38 +1596,30 @@ private:
         cycles += 2;
     }
 
-    inline static void op_jmp(Addr ea)
+    inline void op_jmp(Addr ea)
     {
-        TRACE("JMP");
-
         pc = (Qword)ea;
         cycles += 1;
     }
 
-    inline static void op_jsl(Addr ea)
+    inline void op_jsl(Addr ea)
     {
-        TRACE("JSL");
-
         pushQword(pc - 1);
 
         pc = (Qword)ea;
         cycles += 5; // TODO: fix cycles
     }
 
-    inline static void op_jsr(Addr ea)
+    inline void op_jsr(Addr ea)
     {
-        TRACE("JSR");
-
         pushQword(pc - 1);
 
         pc = (Qword)ea;
         cycles += 4; // TODO: fix cycles
     }
 
-    inline static void op_lda(Addr ea)
+    inline void op_lda(Addr ea)
     {
-        TRACE("LDA");
-
         if (e || p.f_m) {
             setnz_b(a.b = getByte(ea));
             cycles += 2;
@@ -1341,10 +1630,8 @@ private:
         }
     }
 
-    inline static void op_ldx(Addr ea)
+    inline void op_ldx(Addr ea)
     {
-        TRACE("LDX");
-
         if (e || p.f_x) {
             setnz_b(lo_b(x.w = getByte(ea)));
             cycles += 2;
@@ -1355,10 +1642,8 @@ private:
         }
     }
 
-    inline static void op_ldy(Addr ea)
+    inline void op_ldy(Addr ea)
     {
-        TRACE("LDY");
-
         if (e || p.f_x) {
             setnz_b(lo_b(y.w = getByte(ea)));
             cycles += 2;
@@ -1369,10 +1654,8 @@ private:
         }
     }
 
-    inline static void op_lsr(Addr ea)
+    inline void op_lsr(Addr ea)
     {
-        TRACE("LSR");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -1391,10 +1674,8 @@ private:
         }
     }
 
-    inline static void op_lsra(Addr ea)
+    inline void op_lsra(Addr ea)
     {
-        TRACE("LSR");
-
         if (e || p.f_m) {
             setc(a.b & 0x01);
             setnz_b(a.b >>= 1);
@@ -1408,41 +1689,52 @@ private:
         cycles += 2;
     }
 
-    inline static void op_mvn(Addr ea)
+    // Move A+1 bytes upwards from X to Y. Long moves are done MOVE_CHUNK
+    // bytes at a time, the instruction running again for each chunk so that
+    // interrupts and run limits are seen between them. Ends with A = -1 and X
+    // and Y just past the bytes moved.
+    inline void op_mvn(Addr ea)
     {
-        TRACE("MVN");
+        Addr    count = (a.q < MOVE_CHUNK) ? a.q + 1 : (Addr)MOVE_CHUNK;
 
-        Byte src = getByte(ea + 1);
-        Byte dst = getByte(ea + 0);
+        dbr = getByte(ea + 0);
+        for (Addr done = 0; done < count;) {
+            Addr    moved = moveBytes(y.q, x.q, count - done, false);
 
-        setByte(join_w(dbr = dst, y.w++), getByte(join_w(src, x.w++)));
-        if (--a.w != 0xffff) pc -= 3;
-        cycles += 7;
+            x.q += moved;
+            y.q += moved;
+            done += moved;
+        }
+
+        if ((a.q -= count) != ~(Qword)0) pc -= 3;
+        cycles += 7 * count;
     }
 
-    inline static void op_mvp(Addr ea)
+    // Move A+1 bytes downwards from X to Y, the mirror image of MVN
+    inline void op_mvp(Addr ea)
     {
-        TRACE("MVP");
+        Addr    count = (a.q < MOVE_CHUNK) ? a.q + 1 : (Addr)MOVE_CHUNK;
+
+        dbr = getByte(ea + 0);
+        for (Addr done = 0; done < count;) {
+            Addr    moved = moveBytes(y.q, x.q, count - done, true);
 
-        Byte src = getByte(ea + 1);
-        Byte dst = getByte(ea + 0);
+            x.q -= moved;
+            y.q -= moved;
+            done += moved;
+        }
 
-        setByte(join_w(dbr = dst, y.w--), getByte(join_w(src, x.w--)));
-        if (--a.w != 0xffff) pc -= 3;
-        cycles += 7;
+        if ((a.q -= count) != ~(Qword)0) pc -= 3;
+        cycles += 7 * count;
     }
 
-    inline static void op_nop(Addr ea)
+    inline void op_nop(Addr)
     {
-        TRACE("NOP");
-
         cycles += 2;
     }
 
-    inline static void op_ora(Addr ea)
+    inline void op_ora(Addr ea)
     {
-        TRACE("ORA");
-
         if (e || p.f_m) {
             setnz_b(a.b |= getByte(ea));
             cycles += 2;
@@ -1453,34 +1745,26 @@ private:
         }
     }
 
-    inline static void op_pea(Addr ea)
+    inline void op_pea(Addr ea)
     {
-        TRACE("PEA");
-
         pushWord(getWord(ea));
         cycles += 5;
     }
 
-    inline static void op_pei(Addr ea)
+    inline void op_pei(Addr ea)
     {
-        TRACE("PEI");
-
         pushWord(getWord(ea));
         cycles += 6;
     }
 
-    inline static void op_per(Addr ea)
+    inline void op_per(Addr ea)
     {
-        TRACE("PER");
-
         pushWord((Word) ea);
         cycles += 6;
     }
 
-    inline static void op_pha(Addr ea)
+    inline void op_pha(Addr)
     {
-        TRACE("PHA");
-
         if (e || p.f_m) {
             pushByte(a.b);
             cycles += 3;
@@ -1491,42 +1775,32 @@ private:
         }
     }
 
-    inline static void op_phb(Addr ea)
+    inline void op_phb(Addr)
     {
-        TRACE("PHB");
-
         pushByte(dbr);
         cycles += 3;
     }
 
-    inline static void op_phd(Addr ea)
+    inline void op_phd(Addr)
     {
-        TRACE("PHD");
-
         pushWord(dp.w);
         cycles += 4;
     }
 
-    inline static void op_phk(Addr ea)
+    inline void op_phk(Addr)
     {
-        TRACE("PHK");
-
         pushByte(pbr);
         cycles += 3;
     }
 
-    inline static void op_php(Addr ea)
+    inline void op_php(Addr)
     {
-        TRACE("PHP");
-
-        pushByte(p.b);
+        pushByte(getp());
         cycles += 3;
     }
 
-    inline static void op_phx(Addr ea)
+    inline void op_phx(Addr)
     {
-        TRACE("PHX");
-
         if (e || p.f_x) {
             pushByte(x.b);
             cycles += 3;
@@ -1537,10 +1811,8 @@ private:
         }
     }
 
-    inline static void op_phy(Addr ea)
+    inline void op_phy(Addr)
     {
-        TRACE("PHY");
-
         if (e || p.f_x) {
             pushByte(y.b);
             cycles += 3;
@@ -1551,10 +1823,8 @@ private:
         }
     }
 
-    inline static void op_pla(Addr ea)
+    inline void op_pla(Addr)
     {
-        TRACE("PLA");
-
         if (e || p.f_m) {
             setnz_b(a.b = pullByte());
             cycles += 4;
@@ -1565,38 +1835,30 @@ private:
         }
     }
 
-    inline static void op_plb(Addr ea)
+    inline void op_plb(Addr)
     {
-        TRACE("PLB");
-
         setnz_b(dbr = pullByte());
         cycles += 4;
     }
 
-    inline static void op_pld(Addr ea)
+    inline void op_pld(Addr)
     {
-        TRACE("PLD");
-
         setnz_w(dp.w = pullWord());
         cycles += 5;
     }
 
-    inline static void op_plk(Addr ea)
+    inline void op_plk(Addr)
     {
-        TRACE("PLK");
-
         setnz_b(dbr = pullByte());
         cycles += 4;
     }
 
-    inline static void op_plp(Addr ea)
+    inline void op_plp(Addr)
     {
-        TRACE("PLP");
-
         if (e)
-            p.b = pullByte() | 0x30;
+            setp(pullByte() | 0x30);
         else {
-            p.b = pullByte();
+            setp(pullByte());
 
             if (p.f_x) {
                 x.w = x.b;
@@ -1606,10 +1868,8 @@ private:
         cycles += 4;
     }
 
-    inline static void op_plx(Addr ea)
+    inline void op_plx(Addr)
     {
-        TRACE("PLX");
-
         if (e || p.f_x) {
             setnz_b(lo_b(x.w = pullByte()));
             cycles += 4;
@@ -1620,10 +1880,8 @@ private:
         }
     }
 
-    inline static void op_ply(Addr ea)
+    inline void op_ply(Addr)
     {
-        TRACE("PLY");
-
         if (e || p.f_x) {
             setnz_b(lo_b(y.w = pullByte()));
             cycles += 4;
@@ -1634,22 +1892,18 @@ private:
         }
     }
 
-    inline static void op_rep(Addr ea)
+    inline void op_rep(Addr ea)
     {
-        TRACE("REP");
-
-        p.b &= ~getByte(ea);
+        setp(getp() & ~getByte(ea));
         if (e) p.f_m = p.f_x = 1;
         cycles += 3;
     }
 
-    inline static void op_rol(Addr ea)
+    inline void op_rol(Addr ea)
     {
-        TRACE("ROL");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
-            register Byte carry = p.f_c ? 0x01 : 0x00;
+            register Byte carry = flagc() ? 0x01 : 0x00;
 
             setc(data & 0x80);
             setnz_b(data = (data << 1) | carry);
@@ -1658,7 +1912,7 @@ private:
         }
         else {
             register Word data = getWord(ea);
-            register Word carry = p.f_c ? 0x0001 : 0x0000;
+            register Word carry = flagc() ? 0x0001 : 0x0000;
 
             setc(data & 0x8000);
             setnz_w(data = (data << 1) | carry);
@@ -1667,18 +1921,16 @@ private:
         }
     }
 
-    inline static void op_rola(Addr ea)
+    inline void op_rola(Addr)
     {
-        TRACE("ROL");
-
         if (e || p.f_m) {
-            register Byte carry = p.f_c ? 0x01 : 0x00;
+            register Byte carry = flagc() ? 0x01 : 0x00;
 
             setc(a.b & 0x80);
             setnz_b(a.b = (a.b << 1) | carry);
         }
         else {
-            register Word carry = p.f_c ? 0x0001 : 0x0000;
+            register Word carry = flagc() ? 0x0001 : 0x0000;
 
             setc(a.w & 0x8000);
             setnz_w(a.w = (a.w << 1) | carry);
@@ -1686,13 +1938,11 @@ private:
         cycles += 2;
     }
 
-    inline static void op_ror(Addr ea)
+    inline void op_ror(Addr ea)
     {
-        TRACE("ROR");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
-            register Byte carry = p.f_c ? 0x80 : 0x00;
+            register Byte carry = flagc() ? 0x80 : 0x00;
 
             setc(data & 0x01);
             setnz_b(data = (data >> 1) | carry);
@@ -1701,7 +1951,7 @@ private:
         }
         else {
             register Word data = getWord(ea);
-            register Word carry = p.f_c ? 0x8000 : 0x0000;
+            register Word carry = flagc() ? 0x8000 : 0x0000;
 
             setc(data & 0x0001);
             setnz_w(data = (data >> 1) | carry);
@@ -1710,18 +1960,16 @@ private:
         }
     }
 
-    inline static void op_rora(Addr ea)
+    inline void op_rora(Addr)
     {
-        TRACE("ROR");
-
         if (e || p.f_m) {
-            register Byte carry = p.f_c ? 0x80 : 0x00;
+            register Byte carry = flagc() ? 0x80 : 0x00;
 
             setc(a.b & 0x01);
             setnz_b(a.b = (a.b >> 1) | carry);
         }
         else {
-            register Word carry = p.f_c ? 0x8000 : 0x0000;
+            register Word carry = flagc() ? 0x8000 : 0x0000;
 
             setc(a.w & 0x0001);
             setnz_w(a.w = (a.w >> 1) | carry);
@@ -1729,111 +1977,105 @@ private:
         cycles += 2;
     }
 
-    inline static void op_rti(Addr ea)
+    inline void op_rti(Addr)
     {
-        TRACE("RTI");
         /*
         if (e) {
-            p.b = pullByte();
+            setp(pullByte());
             pc = pullWord();
             cycles += 6;
         }
         else {
-            p.b = pullByte();
+            setp(pullByte());
             pc = pullWord();
             pbr = pullByte();
             cycles += 7;
         }
         */
 
-        p.b = pullByte();
-        pc = pullQword();
+        setp(pullFrame(pc));
         cycles += 7; // TODO: fix cycles
-        p.f_i = 0;
+        seti(0);
     }
 
-    inline static void op_rtl(Addr ea)
+    inline void op_rtl(Addr)
     {
-        TRACE("RTL");
-
         pc = pullWord() + 1;
         pbr = pullByte();
         cycles += 6;
     }
 
-    inline static void op_rts(Addr ea)
+    inline void op_rts(Addr)
     {
-        TRACE("RTS");
-
         pc = pullQword() + 1;
         cycles += 6; // TODO: fix cycles
     }
 
-    inline static void op_sbc(Addr ea)
+    inline void op_sbc(Addr ea)
     {
-        TRACE("SBC");
-
         if (e || p.f_m) {
-            Byte    data = ~getByte(ea);
-            Word    temp = a.b + data + p.f_c;
+            Byte    data = getByte(ea);
+            Word    temp;
 
             if (p.f_d) {
-                if ((temp & 0x0f) > 0x09) temp += 0x06;
-                if ((temp & 0xf0) > 0x90) temp += 0x60;
+                bool    carry = flagc();
+
+                temp = (Word)sub_bcd(a.b, data, carry, 8) | (carry ? 0x100 : 0);
+                setv(overflow_bcd(a.b, nines_bcd(data, 8), temp, 8));
+            }
+            else {
+                data = ~data;
+                temp = a.b + data + flagc();
+                setv((~(a.b ^ data)) & (a.b ^ temp) & 0x80);
             }
 
             setc(temp & 0x100);
-            setv((~(a.b ^ data)) & (a.b ^ temp) & 0x80);
             setnz_b(a.b = lo_b(temp));
             cycles += 2;
         }
         else {
-            Word    data = ~getWord(ea);
-            int     temp = a.w + data + p.f_c;
+            Word    data = getWord(ea);
+            int     temp;
 
             if (p.f_d) {
-                if ((temp & 0x000f) > 0x0009) temp += 0x0006;
-                if ((temp & 0x00f0) > 0x0090) temp += 0x0060;
-                if ((temp & 0x0f00) > 0x0900) temp += 0x0600;
-                if ((temp & 0xf000) > 0x9000) temp += 0x6000;
+                bool    carry = flagc();
+
+                temp = (int)sub_bcd(a.w, data, carry, 16) | (carry ? 0x10000 : 0);
+                setv(overflow_bcd(a.w, nines_bcd(data, 16), temp, 16));
+            }
+            else {
+                data = ~data;
+                temp = a.w + data + flagc();
+                setv((~(a.w ^ data)) & (a.w ^ temp) & 0x8000);
             }
 
             setc(temp & 0x10000);
-            setv((~(a.w ^ data)) & (a.w ^ temp) & 0x8000);
             setnz_w(a.w = (Word)temp);
             cycles += 3;
         }
     }
 
-    inline static void op_sec(Addr ea)
+    inline void op_sec(Addr)
     {
-        TRACE("SEC");
-
         setc(1);
         cycles += 2;
     }
 
-    inline static void op_sed(Addr ea)
+    inline void op_sed(Addr)
     {
-        TRACE("SED");
-
         setd(1);
         cycles += 2;
     }
 
-    inline static void op_sei(Addr ea)
+    inline void op_sei(Addr)
     {
-        TRACE("SEI");
-
         seti(1);
         cycles += 2;
     }
 
-    inline static void op_sep(Addr ea)
+    inline void op_sep(Addr ea)
     {
-        TRACE("SEP");
-
-        p.b |= getByte(ea);
+        setp(getp() | getByte(ea));
         if (e) p.f_m = p.f_x = 1;
 
         if (p.f_x) {
@@ -1843,10 +2085,8 @@ private:
         cycles += 3;
     }
 
-    inline static void op_sta(Addr ea)
+    inline void op_sta(Addr ea)
     {
-        TRACE("STA");
-
         if (e || p.f_m) {
             setByte(ea, a.b);
             cycles += 2;
@@ -1857,23 +2097,20 @@ private:
         }
     }
 
-    inline static void op_stp(Addr ea)
+    inline void op_stp(Addr)
     {
-        TRACE("STP");
-
-        if (!interrupted) {
-            pc -= 1;
-        }
-        else
+        if (!interrupted && !pending)
+            halted = true;
+        else {
             interrupted = false;
+            woke();
+        }
 
         cycles += 3; // TODO: fix cycles
     }
 
-    inline static void op_stx(Addr ea)
+    inline void op_stx(Addr ea)
     {
-        TRACE("STX");
-
         if (e || p.f_x) {
             setByte(ea, x.b);
             cycles += 2;
@@ -1884,10 +2121,8 @@ private:
         }
     }
 
-    inline static void op_sty(Addr ea)
+    inline void op_sty(Addr ea)
     {
-        TRACE("STY");
-
         if (e || p.f_x) {
             setByte(ea, y.b);
             cycles += 2;
@@ -1898,10 +2133,8 @@ private:
         }
     }
 
-    inline static void op_stz(Addr ea)
+    inline void op_stz(Addr ea)
     {
-        TRACE("STZ");
-
         if (e || p.f_m) {
             setByte(ea, 0);
             cycles += 2;
@@ -1912,10 +2145,8 @@ private:
         }
     }
 
-    inline static void op_tax(Addr ea)
+    inline void op_tax(Addr)
     {
-        TRACE("TAX");
-
         if (e || p.f_x)
             setnz_b(lo_b(x.w = a.b));
         else
@@ -1924,10 +2155,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_tay(Addr ea)
+    inline void op_tay(Addr)
     {
-        TRACE("TAY");
-
         if (e || p.f_x)
             setnz_b(lo_b(y.w = a.b));
         else
@@ -1936,18 +2165,14 @@ private:
         cycles += 2;
     }
 
-    inline static void op_tcd(Addr ea)
+    inline void op_tcd(Addr)
     {
-        TRACE("TCD");
-
         dp.w = a.w;
         cycles += 2;
     }
 
-    inline static void op_tdc(Addr ea)
+    inline void op_tdc(Addr)
     {
-        TRACE("TDC");
-
         if (e || p.f_m)
             setnz_b(lo_b(a.w = dp.w));
         else
@@ -1956,18 +2181,14 @@ private:
         cycles += 2;
     }
 
-    inline static void op_tcs(Addr ea)
+    inline void op_tcs(Addr)
     {
-        TRACE("TCS");
-
         sp.w = e ? (0x0100 | a.b) : a.w;
         cycles += 2;
     }
 
-    inline static void op_trb(Addr ea)
+    inline void op_trb(Addr ea)
     {
-        TRACE("TRB");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -1984,10 +2205,8 @@ private:
         }
     }
 
-    inline static void op_tsb(Addr ea)
+    inline void op_tsb(Addr ea)
     {
-        TRACE("TSB");
-
         if (e || p.f_m) {
             register Byte data = getByte(ea);
 
@@ -2004,10 +2223,8 @@ private:
         }
     }
 
-    inline static void op_tsc(Addr ea)
+    inline void op_tsc(Addr)
     {
-        TRACE("TSC");
-
         if (e || p.f_m)
             setnz_b(lo_b(a.w = sp.w));
         else
@@ -2016,10 +2233,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_tsx(Addr ea)
+    inline void op_tsx(Addr)
     {
-        TRACE("TSX");
-
         if (e)
             setnz_b(x.b = sp.b);
         else
@@ -2028,10 +2243,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_txa(Addr ea)
+    inline void op_txa(Addr)
     {
-        TRACE("TXA");
-
         if (e || p.f_m)
             setnz_b(a.b = x.b);
         else
@@ -2040,10 +2253,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_txs(Addr ea)
+    inline void op_txs(Addr)
     {
-        TRACE("TXS");
-
         if (e)
             sp.w = 0x0100 | x.b;
         else
@@ -2052,10 +2263,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_txy(Addr ea)
+    inline void op_txy(Addr)
     {
-        TRACE("TXY");
-
         if (e || p.f_x)
             setnz_b(lo_b(y.w = x.w));
         else
@@ -2064,10 +2273,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_tya(Addr ea)
+    inline void op_tya(Addr)
     {
-        TRACE("TYA");
-
         if (e || p.f_m)
             setnz_b(a.b = y.b);
         else
@@ -2076,10 +2283,8 @@ private:
         cycles += 2;
     }
 
-    inline static void op_tyx(Addr ea)
+    inline void op_tyx(Addr)
     {
-        TRACE("TYX");
-
         if (e || p.f_x)
             setnz_b(lo_b(x.w = y.w));
         else
@@ -2088,48 +2293,46 @@ private:
         cycles += 2;
     }
 
-    inline static void op_wai(Addr ea)
+    inline void op_und(Addr)
     {
-        TRACE("WAI");
+        cycles += 2;
+    }
 
-        if (!interrupted) {
-            pc -= 1;
-        }
-        else
+    inline void op_wai(Addr)
+    {
+        if (!interrupted && !pending)
+            halted = true;
+        else {
             interrupted = false;
+            woke();
+        }
 
         cycles += 3;
     }
 
-    inline static void op_wdm(Addr ea)
+    inline void op_wdm(Addr ea)
     {
-        TRACE("WDM");
-
         switch (getByte(ea)) {
         case 0x01:  std::cout << (char) a.b; break;
-        case 0x02:  std::cin >> a.b; break;
+        case 0x02:  a.b = input(); break;
         case 0xff:  stopped = true;  break;
         }
         cycles += 3;
     }
 
-    inline static void op_xba(Addr ea)
+    inline void op_xba(Addr)
     {
-        TRACE("XBA");
-
         a.w = swap_w(a.w);
         setnz_b(a.b);
         cycles += 3;
     }
 
-    inline static void op_xce(Addr ea)
+    inline void op_xce(Addr)
     {
-        TRACE("XCE");
-
         unsigned char   oe = e;
 
-        e = p.f_c;
-        p.f_c = oe;
+        e = flagc();
+        fc = oe;
 
         if (e) {
             p.b |= 0x30;
@@ -2139,34 +2342,4 @@ private:
     }
 };
 
-// Rust ffi wrappers
-extern "C" {
-    void emu65x64_setMemory(unsigned long long memMask, unsigned long long ramSize, const unsigned char *pROM) {
-        emu65x64::setMemory(memMask, ramSize, pROM);
-    }
-
-    void emu65x64_setMemoryRam(unsigned long long memMask, unsigned long long ramSize, unsigned char *pRAM, const unsigned char *pROM) {
-        emu65x64::setMemory(memMask, ramSize, pRAM, pROM);
-    }
-
-    void emu65x64_reset(bool trace) {
-        emu65x64::reset(trace);
-    }
-
-    void emu65x64_step() {
-        emu65x64::step();
-    }
-
-    unsigned long emu65x64_getCycles() {
-        return emu65x64::getCycles();
-    }
-
-    bool emu65x64_isStopped() {
-        return emu65x64::isStopped();
-    }
-
-    void emu65x64_setPc(unsigned long long pc) {
-        emu65x64::pc = (emu65x64::Qword)pc;
-    }
-}
 #endif
@@ -0,0 +1,758 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+#include "jit65x64.hpp"
+
+#ifdef JIT65X64
+
+#include "emu65x64.hpp"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Instructions that always leave the block
+static const char *const endings[] = {
+    "jmp", "jsr", "rts", "rti", "rtl", "bra", "brl", "brk", "cop", NULL
+};
+
+// Instructions left to the interpreter
+static const char *const skipped[] = {
+    "und", "stp", "wai", "wdm", NULL
+};
+
+// Instructions translated to host code when in a supported addressing mode
+static const char *const accesses[] = {
+    "lda", "ldx", "ldy", "sta", "stx", "sty", "stz",
+    "and", "ora", "eor", "cmp", "cpx", "cpy", NULL
+};
+
+// Addressing modes whose effective address is computed inline
+static const char *const addressed[] = {
+    "absl", "absx", "absy", "dpag", "dpgx", "dpgy", NULL
+};
+
+// Conditional branches, the flag each tests and the value it branches on
+static const struct {
+    const char         *name;
+    char                flag;
+    bool                set;
+} branches[] = {
+    { "bcc", 'c', false },  { "bcs", 'c', true },
+    { "bne", 'z', false },  { "beq", 'z', true },
+    { "bpl", 'n', false },  { "bmi", 'n', true },
+    { "bvc", 'v', false },  { "bvs", 'v', true },
+    { NULL, 0, false }
+};
+
+//==============================================================================
+// Stubs
+//------------------------------------------------------------------------------
+
+// Each stub runs one instruction whose operand has been latched and whose pc
+// points past the opcode, exactly as the interpreter would after fetch().
+#define OP(CODE, NAME, MODE, MNEM, LEN, CYC) \
+    template <> bool jit65x64::exec<CODE>(emu65x64 *emu) \
+    { \
+        emu->op_##NAME(emu->am_##MODE()); \
+        return (emu->jit->leaving()); \
+    }
+OPS65X64(OP)
+#undef OP
+
+#define OP(CODE, NAME, MODE, MNEM, LEN, CYC)   &jit65x64::exec<CODE>,
+const jit65x64::STUB        jit65x64::stubs[256] = { OPS65X64(OP) };
+#undef OP
+
+#define OP(CODE, NAME, MODE, MNEM, LEN, CYC)   #NAME,
+const char *const           jit65x64::names[256] = { OPS65X64(OP) };
+#undef OP
+
+#define OP(CODE, NAME, MODE, MNEM, LEN, CYC)   #MODE,
+const char *const           jit65x64::modes[256] = { OPS65X64(OP) };
+#undef OP
+
+// Test if the run has used its budget or something needs the caller
+inline bool jit65x64::finished() const
+{
+    return (count == 0 || emu->cycles >= emu->until ||
+        emu->stopped || emu->halted || emu->raised || emu->isPending());
+}
+
+// Count an instruction and test if the current block must be left
+inline bool jit65x64::leaving()
+{
+    --count;
+    return (finished() || stale);
+}
+
+// Test if an opcode's handler is one of the names in a list
+bool jit65x64::isNamed(Byte opcode, const char *const *list)
+{
+    for (; *list; ++list) {
+        if (strcmp(names[opcode], *list) == 0)
+            return (true);
+    }
+    return (false);
+}
+
+// Test if a name is in a list
+static bool isListed(const char *name, const char *const *list)
+{
+    for (; *list; ++list) {
+        if (strcmp(name, *list) == 0)
+            return (true);
+    }
+    return (false);
+}
+
+//==============================================================================
+
+// Allocate the code buffer and write the entry and exit sequences that all
+// blocks share
+jit65x64::jit65x64(emu65x64 *emu)
+    : emu(emu), buffer(NULL), next(NULL), enter(NULL), stop(NULL), leave(NULL),
+      count(0), stale(false)
+{
+    void *host = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    memset(waiting, 0, sizeof(waiting));
+
+    if (host == MAP_FAILED)
+        return;
+
+    buffer = next = (Byte *)host;
+
+    // enter(emu, code): keep emu in rbx, which also aligns the stack
+    enter = (Byte *(*)(emu65x64 *, Byte *))next;
+    emit("\x53", 1);                    // push rbx
+    emit("\x48\x89\xfb", 3);            // mov  rbx, rdi
+    emit("\xff\xe6", 2);                // jmp  rsi
+
+    stop = next;
+    emit("\x31\xc0", 2);                // xor  eax, eax
+
+    leave = next;
+    emit("\x5b", 1);                    // pop  rbx
+    emit("\xc3", 1);                    // ret
+
+    protect(buffer, BUFFER_SIZE, false);
+    flush();
+}
+
+// Release the code buffer
+jit65x64::~jit65x64()
+{
+    if (buffer)
+        munmap(buffer, BUFFER_SIZE);
+}
+
+// Execute until the budget is used or something needs the caller, running
+// translated blocks where possible and single instructions elsewhere.
+// Returns the number of instructions left of count.
+unsigned long jit65x64::run(unsigned long count)
+{
+    jit65x64::count = count;
+
+    for (;;) {
+        if (stale)
+            flush();
+
+        Byte *code = find(emu->pc);
+
+        if (code) {
+            Byte *site = enter(emu, code);
+
+            if (site && !stale)
+                chain(site, emu->pc);
+            else if (!site && finished())
+                return (jit65x64::count);
+        }
+        else if (stubs[emu->fetch()](emu) && finished())
+            return (jit65x64::count);
+    }
+}
+
+// Note stores to translated code. Their pages are left to the interpreter
+// from now on. A change to the whole memory map starts again from scratch.
+void jit65x64::codeChanged(Addr first, Addr last)
+{
+    if (first == 0 && last == ~(Addr)0) {
+        writable.clear();
+        stale = true;
+        return;
+    }
+
+    for (Addr page = first >> emu65x64::PAGE_BITS; page <= last >> emu65x64::PAGE_BITS; ++page) {
+        if (pages.count(page)) {
+            writable.insert(page);
+            stale = true;
+        }
+    }
+}
+
+//==============================================================================
+// Blocks
+//------------------------------------------------------------------------------
+
+// Return the block for an address, translating it once it has become hot
+jit65x64::Byte *jit65x64::find(Addr pc)
+{
+    std::unordered_map<Addr, Byte *>::const_iterator it = blocks.find(pc);
+
+    if (it != blocks.end())
+        return (it->second);
+
+    Byte &visits = heat[pc & HEAT_MASK];
+
+    if (++visits < HOT_COUNT)
+        return (NULL);
+
+    visits = 0;
+
+    Byte *code = compile(pc);
+
+    if (!stale)
+        blocks[pc] = code;
+    return (code);
+}
+
+// Translate the instructions from pc up to the end of the basic block. Each
+// one runs as host code if translate() can manage it, and otherwise sets up
+// the operand and pc, calls its stub and checks that execution fell through,
+// leaving by its own exit if not.
+jit65x64::Byte *jit65x64::compile(Addr pc)
+{
+    Byte *fixups[BLOCK_LENGTH];
+    Byte *entry = next;
+    unsigned int length = 0;
+
+    if ((Addr)(buffer + BUFFER_SIZE - next) < BLOCK_BYTES) {
+        stale = true;
+        return (NULL);
+    }
+
+    protect(entry, BLOCK_BYTES, true);
+
+    while (length < BLOCK_LENGTH) {
+        emu65x64::DECODED insn;
+        Addr page = emu->resolve(pc) >> emu65x64::PAGE_BITS;
+
+        if (writable.count(page) || !emu->watchCode(pc, pc))
+            break;
+        if (!emu->decode(insn, pc) || isNamed(insn.opcode, skipped))
+            break;
+
+        const emu65x64::OPCODE &opcode = emu65x64::opcodes[insn.opcode];
+        Addr after = pc + opcode.length;
+
+        pages.insert(page);
+        pages.insert(emu->resolve(pc + opcode.operand) >> emu65x64::PAGE_BITS);
+
+        translate(insn.opcode, insn.operand, pc);
+        land(LABEL_MISS);
+
+        if (opcode.operand) {
+            emit("\x48\xb8", 2);        // mov  rax, operand
+            emit64(insn.operand);
+            field("\x48\x89\x83", 3, &emu->operand); // mov [rbx + operand], rax
+        }
+
+        emit("\x48\xb8", 2);            // mov  rax, pc + 1
+        emit64(pc + 1);
+        field("\x48\x89\x83", 3, &emu->pc); // mov [rbx + pc], rax
+
+        emit("\x48\x89\xdf", 3);        // mov  rdi, rbx
+        emit("\x48\xb8", 2);            // mov  rax, stub
+        emit64((Qword)stubs[insn.opcode]);
+        emit("\xff\xd0", 2);            // call rax
+        emit("\x84\xc0", 2);            // test al, al
+        jump(0x85, stop);               // jnz  stop
+
+        land(LABEL_CHECK);
+        emit("\x48\xb8", 2);            // mov  rax, after
+        emit64(after);
+        field("\x48\x39\x83", 3, &emu->pc); // cmp [rbx + pc], rax
+        fixups[length++] = hole(0x85);  // jne  exit
+        land(LABEL_DONE);
+
+        pc = after;
+        if (isNamed(insn.opcode, endings))
+            break;
+    }
+
+    if (length == 0) {
+        next = entry;
+        protect(entry, BLOCK_BYTES, false);
+        return (NULL);
+    }
+
+    // The last instruction falls through into its exit
+    for (unsigned int index = length; index-- > 0;) {
+        bind(fixups[index]);
+        exit();
+    }
+
+    protect(entry, BLOCK_BYTES, false);
+    return (entry);
+}
+
+// Patch an unchained exit to jump straight to the block for pc. The exit
+// compares the pc against the one seen here and returns to run() if it differs.
+void jit65x64::chain(Byte *site, Addr pc)
+{
+    unsigned int disp;
+
+    memcpy(&disp, site + EXIT_JUMP, 4);
+    if (disp != 0)
+        return;
+
+    std::unordered_map<Addr, Byte *>::const_iterator it = blocks.find(pc);
+
+    if (it == blocks.end() || !it->second)
+        return;
+
+    disp = (unsigned int)(it->second - (site + EXIT_MISS));
+    protect(site, EXIT_MISS, true);
+    memcpy(site + EXIT_GUARD, &pc, 8);
+    memcpy(site + EXIT_JUMP, &disp, 4);
+    protect(site, EXIT_MISS, false);
+}
+
+// Discard all translated blocks
+void jit65x64::flush()
+{
+    blocks.clear();
+    pages.clear();
+    memset(heat, 0, sizeof(heat));
+
+    next = leave + 2;
+    stale = false;
+}
+
+// Make the pages covering size bytes at first writable while code is emitted
+// or patched there, or executable again afterwards. They are never both.
+void jit65x64::protect(Byte *first, Addr size, bool writing)
+{
+    const Addr hostPage = sysconf(_SC_PAGESIZE);
+    Addr start = (Addr)first & ~(hostPage - 1);
+    Addr end = ((Addr)first + size + hostPage - 1) & ~(hostPage - 1);
+
+    mprotect((void *)start, end - start,
+        writing ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+}
+
+//==============================================================================
+// Translation
+//------------------------------------------------------------------------------
+
+// Emit host code for an instruction that has a direct translation. A failed
+// width guard or TLB lookup jumps to LABEL_MISS before anything has changed,
+// so that the stub runs the instruction instead. Finishes with a jump to
+// LABEL_DONE, or to LABEL_CHECK once a branch is taken. Emits nothing and
+// returns false for any other instruction.
+bool jit65x64::translate(Byte opcode, Qword operand, Addr pc)
+{
+    const char *name = names[opcode];
+    const char *mode = modes[opcode];
+    Addr after = pc + emu65x64::opcodes[opcode].length;
+
+    for (unsigned int index = 0; branches[index].name; ++index) {
+        if (strcmp(name, branches[index].name) != 0)
+            continue;
+
+        Addr target = after + (signed short)(Word)operand;
+        char flag = branches[index].flag;
+
+        // Z is set when fz is zero, the others when theirs are not
+        if (flag == 'z') {
+            field("\x48\x83\xbb", 3, &emu->fz); // cmp qword [rbx + fz], 0
+            emit(0x00);
+        }
+        else {
+            field("\x83\xbb", 2, flag == 'c' ? &emu->fc : flag == 'n' ? &emu->fn : &emu->fv);
+            emit(0x00);                 // cmp  dword [rbx + flag], 0
+        }
+
+        Byte *skip = hole(((flag == 'z') == branches[index].set) ? 0x85 : 0x84);
+
+        // Taken, with a cycle more for a page crossing in emulation mode
+        if ((after ^ target) & 0xff00) {
+            field("\x0f\xb6\x83", 3, &emu->e); // movzx eax, byte [rbx + e]
+            emit("\x48\x83\xc0\x04", 4); // add  rax, 4
+            field("\x48\x01\x83", 3, &emu->cycles); // add [rbx + cycles], rax
+            retire((Word)target, 0);
+        }
+        else
+            retire((Word)target, 4);
+        forward(LABEL_CHECK, 0);
+
+        bind(skip);
+        retire(after, 3);
+        forward(LABEL_DONE, 0);
+        return (true);
+    }
+
+    if (!strcmp(name, "clc") || !strcmp(name, "sec") || !strcmp(name, "clv")) {
+        field("\xc7\x83", 2, name[2] == 'v' ? &emu->fv : &emu->fc);
+        emit32(name[0] == 's' ? 1 : 0); // mov  dword [rbx + flag], value
+        retire(after, 2);
+        forward(LABEL_DONE, 0);
+        return (true);
+    }
+
+    if (!strcmp(name, "nop")) {
+        retire(after, 2);
+        forward(LABEL_DONE, 0);
+        return (true);
+    }
+
+    if (!strcmp(name, "inx") || !strcmp(name, "iny") ||
+            !strcmp(name, "dex") || !strcmp(name, "dey")) {
+        const void *reg = (name[2] == 'x') ? (const void *)&emu->x : (const void *)&emu->y;
+        bool wide = !(emu->e || emu->p.f_x);
+
+        guard(4, wide);
+        if (wide) {
+            field("\x66\x8b\x83", 3, reg); // mov  ax, [rbx + reg]
+            emit(name[0] == 'i' ? "\x66\xff\xc0" : "\x66\xff\xc8", 3); // inc/dec ax
+            field("\x66\x89\x83", 3, reg); // mov  [rbx + reg], ax
+            emit("\x0f\xb7\xc0", 3);    // movzx eax, ax
+        }
+        else {
+            field("\x8a\x83", 2, reg);  // mov  al, [rbx + reg]
+            emit(name[0] == 'i' ? "\xfe\xc0" : "\xfe\xc8", 2); // inc/dec al
+            field("\x88\x83", 2, reg);  // mov  [rbx + reg], al
+            emit("\x0f\xb6\xc0", 3);    // movzx eax, al
+        }
+        setnz(wide ? 2 : 1);
+        retire(after, 2);
+        forward(LABEL_DONE, 0);
+        return (true);
+    }
+
+    if (!isListed(name, accesses) || !isListed(mode, addressed))
+        return (false);
+
+    // AND works on the whole register, the others on the A or X/Y width
+    bool indexed = (name[2] == 'x' || name[2] == 'y');
+    bool wide = indexed ? !(emu->e || emu->p.f_x) : !(emu->e || emu->p.f_m);
+    unsigned int size = !strcmp(name, "and") ? 8 : wide ? 2 : 1;
+    bool store = (name[0] == 's');
+    const void *reg = (name[2] == 'x') ? (const void *)&emu->x :
+        (name[2] == 'y') ? (const void *)&emu->y : (const void *)&emu->a;
+
+    // An absolute operand known to straddle pages always takes the slow path
+    if (!strcmp(mode, "absl") &&
+            (operand & emu65x64::PAGE_MASK) > emu65x64::PAGE_SIZE - size)
+        return (false);
+
+    if (size != 8)
+        guard(indexed ? 4 : 5, wide);
+    address(mode, operand, size, store ? (const void *)emu->wrTlb : (const void *)emu->rdTlb);
+
+    if (!strcmp(name, "stz"))
+        emit(wide ? "\x66\xc7\x02\x00\x00" : "\xc6\x02\x00", wide ? 5 : 3); // mov [rdx], 0
+    else if (store) {
+        if (wide) {
+            field("\x66\x8b\x8b", 3, reg); // mov cx, [rbx + reg]
+            emit("\x66\x89\x0a", 3);    // mov  [rdx], cx
+        }
+        else {
+            field("\x8a\x8b", 2, reg);  // mov  cl, [rbx + reg]
+            emit("\x88\x0a", 2);        // mov  [rdx], cl
+        }
+    }
+    else {
+        if (size == 8)
+            emit("\x48\x8b\x02", 3);    // mov  rax, [rdx]
+        else if (wide)
+            emit("\x0f\xb7\x02", 3);    // movzx eax, word [rdx]
+        else
+            emit("\x0f\xb6\x02", 3);    // movzx eax, byte [rdx]
+
+        if (!strcmp(name, "and")) {
+            field("\x48\x23\x83", 3, reg); // and rax, [rbx + a]
+            field("\x48\x89\x83", 3, reg); // mov [rbx + a], rax
+        }
+        else if (!strcmp(name, "ora") || !strcmp(name, "eor")) {
+            bool ora = (name[0] == 'o');
+
+            if (wide) {
+                field(ora ? "\x66\x0b\x83" : "\x66\x33\x83", 3, reg); // or/xor ax, [rbx + a]
+                field("\x66\x89\x83", 3, reg); // mov [rbx + a], ax
+                emit("\x0f\xb7\xc0", 3);    // movzx eax, ax
+            }
+            else {
+                field(ora ? "\x0a\x83" : "\x32\x83", 2, reg); // or/xor al, [rbx + a]
+                field("\x88\x83", 2, reg);  // mov  [rbx + a], al
+                emit("\x0f\xb6\xc0", 3);    // movzx eax, al
+            }
+        }
+        else if (name[0] == 'c') {
+            field(wide ? "\x0f\xb7\x8b" : "\x0f\xb6\x8b", 3, reg); // movzx ecx, [rbx + reg]
+            emit("\x29\xc1", 2);        // sub  ecx, eax
+            emit("\x89\xc8", 2);        // mov  eax, ecx
+            emit(0x25);                 // and  eax, carry
+            emit32(wide ? 0x10000 : 0x100);
+            field("\x89\x83", 2, &emu->fc); // mov [rbx + fc], eax
+            emit(wide ? "\x0f\xb7\xc1" : "\x0f\xb6\xc1", 3); // movzx eax, cx/cl
+        }
+        else if (name[2] == 'a' && !wide)
+            field("\x88\x83", 2, reg);  // mov  [rbx + a], al
+        else
+            field("\x66\x89\x83", 3, reg); // mov [rbx + reg], ax
+
+        setnz(size);
+    }
+
+    retire(after, ((mode[0] == 'a') ? 2 : 1) + ((size == 1) ? 2 : 3));
+    forward(LABEL_DONE, 0);
+    return (true);
+}
+
+// Emit a check that the A (shift 5) or X/Y (shift 4) width is still the one
+// the code was translated for, jumping to LABEL_MISS if not
+void jit65x64::guard(unsigned int shift, bool wide)
+{
+    field("\x0f\xb6\x83", 3, &emu->p); // movzx eax, byte [rbx + p]
+    emit("\xc1\xe8", 2);                // shr  eax, shift
+    emit((Byte)shift);
+    field("\x0a\x83", 2, &emu->e);      // or   al, [rbx + e]
+    emit("\xa8\x01", 2);                // test al, 1
+    forward(LABEL_MISS, wide ? 0x85 : 0x84);
+}
+
+// Emit the effective address calculation for an addressing mode and its TLB
+// lookup, leaving the host address of the size byte operand in rdx. Jumps to
+// LABEL_MISS if the page has no entry or the operand runs off its end.
+void jit65x64::address(const char *mode, Qword operand, unsigned int size, const void *tlb)
+{
+    static_assert(sizeof(mem65x64::TLB) == 16, "TLB entries are indexed by a shift of 4");
+
+    if (!strcmp(mode, "absl")) {
+        Addr page = operand >> emu65x64::PAGE_BITS;
+        unsigned int entry = offset(tlb) + (unsigned int)(page & emu65x64::TLB_MASK) * 16;
+
+        emit("\x48\xb8", 2);            // mov  rax, page
+        emit64(page);
+        emit("\x48\x3b\x83", 3);        // cmp  rax, [rbx + entry]
+        emit32(entry);
+        forward(LABEL_MISS, 0x85);
+        emit("\x48\x8b\x93", 3);        // mov  rdx, [rbx + entry + 8]
+        emit32(entry + 8);
+        emit("\x48\x8d\x92", 3);        // lea  rdx, [rdx + offset]
+        emit32((unsigned int)(operand & emu65x64::PAGE_MASK));
+        return;
+    }
+
+    if (mode[0] == 'a') {
+        emit("\x48\xb8", 2);            // mov  rax, operand
+        emit64(operand);
+        field("\x48\x03\x83", 3, (mode[3] == 'x') ? &emu->x : &emu->y); // add rax, [rbx + reg]
+    }
+    else {
+        if (mode[3] == 'g') {
+            emit(0xb8);                 // mov  eax, operand
+            emit32((Dword)operand);
+        }
+        else {
+            field("\x8b\x83", 2, (mode[3] == 'x') ? &emu->x : &emu->y); // mov eax, [rbx + reg]
+            emit(0x05);                 // add  eax, operand
+            emit32((Dword)operand);
+        }
+        field("\x48\x03\x83", 3, &emu->dp); // add rax, [rbx + dp]
+    }
+
+    emit("\x48\x89\xc2", 3);            // mov  rdx, rax
+    emit("\x48\xc1\xea", 3);            // shr  rdx, PAGE_BITS
+    emit((Byte)emu65x64::PAGE_BITS);
+    emit("\x89\xd1", 2);                // mov  ecx, edx
+    emit("\x81\xe1", 2);                // and  ecx, TLB_MASK
+    emit32(emu65x64::TLB_MASK);
+    emit("\xc1\xe1\x04", 3);            // shl  ecx, 4
+    emit("\x48\x3b\x94\x0b", 4);        // cmp  rdx, [rbx + rcx + tlb]
+    emit32(offset(tlb));
+    forward(LABEL_MISS, 0x85);
+    emit(0x25);                         // and  eax, PAGE_MASK
+    emit32(emu65x64::PAGE_MASK);
+    if (size > 1) {
+        emit(0x3d);                     // cmp  eax, PAGE_SIZE - size
+        emit32(emu65x64::PAGE_SIZE - size);
+        forward(LABEL_MISS, 0x87);
+    }
+    emit("\x48\x03\x84\x0b", 4);        // add  rax, [rbx + rcx + tlb + 8]
+    emit32(offset(tlb) + 8);
+    emit("\x48\x89\xc2", 3);            // mov  rdx, rax
+}
+
+// Emit the setting of N and Z from the size byte value zero extended in rax
+void jit65x64::setnz(unsigned int size)
+{
+    field("\x48\x89\x83", 3, &emu->fz); // mov [rbx + fz], rax
+    if (size == 8)
+        emit("\x48\xc1\xe8\x3f", 4);    // shr  rax, 63
+    else {
+        emit(0x25);                     // and  eax, sign
+        emit32((size == 1) ? 0x80 : 0x8000);
+    }
+    field("\x89\x83", 2, &emu->fn);     // mov  [rbx + fn], eax
+}
+
+// Emit the end of a translated instruction: add its cycles, move the pc on,
+// count it and leave the block if the run is over
+void jit65x64::retire(Addr pc, unsigned int cycles)
+{
+    if (cycles) {
+        field("\x48\x83\x83", 3, &emu->cycles); // add qword [rbx + cycles], cycles
+        emit((Byte)cycles);
+    }
+
+    emit("\x48\xb8", 2);                // mov  rax, pc
+    emit64(pc);
+    field("\x48\x89\x83", 3, &emu->pc); // mov [rbx + pc], rax
+
+    emit("\x48\xb8", 2);                // mov  rax, &count
+    emit64((Qword)&count);
+    emit("\x48\xff\x08", 3);            // dec  qword [rax]
+    jump(0x84, stop);                   // jz   stop
+
+    field("\x48\x8b\x83", 3, &emu->cycles); // mov rax, [rbx + cycles]
+    field("\x48\x3b\x83", 3, &emu->until); // cmp rax, [rbx + until]
+    jump(0x83, stop);                   // jae  stop
+}
+
+//==============================================================================
+// Code Generation
+//------------------------------------------------------------------------------
+
+// Emit a byte
+void jit65x64::emit(Byte value)
+{
+    *next++ = value;
+}
+
+// Emit a sequence of bytes
+void jit65x64::emit(const char *bytes, unsigned int count)
+{
+    memcpy(next, bytes, count);
+    next += count;
+}
+
+// Emit a little endian dword
+void jit65x64::emit32(unsigned int value)
+{
+    memcpy(next, &value, 4);
+    next += 4;
+}
+
+// Emit a little endian qword
+void jit65x64::emit64(Qword value)
+{
+    memcpy(next, &value, 8);
+    next += 8;
+}
+
+// Emit an instruction addressing a field of the emulator through rbx
+void jit65x64::field(const char *bytes, unsigned int count, const void *field)
+{
+    emit(bytes, count);
+    emit32(offset(field));
+}
+
+// Emit a conditional jump (0x0f opcode) to a target in the buffer
+void jit65x64::jump(Byte opcode, const Byte *target)
+{
+    emit(0x0f);
+    emit(opcode);
+    emit32((unsigned int)(target - (next + 4)));
+}
+
+// Emit a conditional jump (0x0f opcode), or a plain one for opcode zero,
+// whose target is not known yet. Returns the address following it, for
+// bind() to fill in.
+jit65x64::Byte *jit65x64::hole(Byte opcode)
+{
+    if (opcode) {
+        emit(0x0f);
+        emit(opcode);
+    }
+    else
+        emit(0xe9);
+    emit32(0);
+    return (next);
+}
+
+// Point the jump ending at site to the next byte emitted
+void jit65x64::bind(Byte *site)
+{
+    unsigned int disp = (unsigned int)(next - site);
+
+    memcpy(site - 4, &disp, 4);
+}
+
+// Emit a jump to a label that land() will place later
+void jit65x64::forward(unsigned int label, Byte opcode)
+{
+    jumps[label][waiting[label]++] = hole(opcode);
+}
+
+// Place a label here, binding the jumps waiting for it
+void jit65x64::land(unsigned int label)
+{
+    while (waiting[label] > 0)
+        bind(jumps[label][--waiting[label]]);
+}
+
+// Emit a block exit. A raised interrupt line returns to run(). If the pc
+// matches the chained one it jumps to that block, otherwise it returns its
+// own address to run() so it can be chained.
+void jit65x64::exit()
+{
+    field("\x80\xbb", 2, &emu->raised); // cmp byte [rbx + raised], 0
+    emit(0x00);
+    jump(0x85, stop);                   // jne  stop
+    field("\x80\xbb", 2, &emu->replaying); // cmp byte [rbx + replaying], 0
+    emit(0x00);
+    emit("\x75\x14", 2);                // jne  chain, past the line test
+    field("\x8b\x83", 2, &emu->masked); // mov eax, [rbx + masked]
+    emit("\xf7\xd0", 2);                // not  eax
+    field("\x85\x83", 2, &emu->pending); // test [rbx + pending], eax
+    jump(0x85, stop);                   // jnz  stop
+
+    Byte *site = next;
+
+    emit("\x48\x8b\x83", 3);            // mov  rax, [rbx + pc]
+    emit32(offset(&emu->pc));
+    emit("\x48\xb9", 2);                // mov  rcx, chained pc
+    emit64(~(Qword)0);
+    emit("\x48\x39\xc8", 3);            // cmp  rax, rcx
+    emit("\x75\x05", 2);                // jne  miss
+    emit(0xe9);                         // jmp  chained block
+    emit32(0);
+    emit("\x48\x8d\x05", 3);            // miss: lea rax, [site]
+    emit32((unsigned int)(site - (next + 4)));
+    emit(0xe9);                         // jmp  leave
+    emit32((unsigned int)(leave - (next + 4)));
+}
+
+#endif
@@ -0,0 +1,165 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+#ifndef JIT65X64_H
+#define JIT65X64_H
+
+#include "nozo65x64.hpp"
+
+// The translator emits x86-64 code so it is only built for Linux x86-64 hosts
+// with GCC or Clang. Elsewhere the emulator always interprets.
+#if defined(__x86_64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+# define JIT65X64
+#endif
+
+#ifdef JIT65X64
+
+#include <unordered_map>
+#include <unordered_set>
+
+class emu65x64;
+
+// The jit65x64 class translates hot basic blocks of 65x64 code into x86-64.
+//
+// Loads, stores, logic and compares in the absolute and direct page modes,
+// register increments, flag changes and conditional branches become host
+// code working on the emulator's registers, with the TLB lookup inline.
+// Each is guarded by a check of the register width it was translated for.
+// When a guard or lookup fails, and for every other instruction, the block
+// calls a stub that runs the op_ handler with the operand and pc already in
+// place. Blocks leave through exits that are patched to jump straight to the
+// block that was found to follow them. Anything that cannot be translated
+// is left to the interpreter.
+//
+// The code buffer is never writable and executable at once. The pages being
+// emitted or patched are made writable for the duration and then executable
+// again.
+class jit65x64 :
+    public nozo65x64
+{
+public:
+    jit65x64(emu65x64 *emu);
+    ~jit65x64();
+
+    // Test if the code buffer could be allocated
+    inline bool isReady() const
+    {
+        return (buffer != NULL);
+    }
+
+    unsigned long run(unsigned long count);
+    void codeChanged(Addr first, Addr last);
+
+private:
+    jit65x64(const jit65x64 &);
+    jit65x64 &operator=(const jit65x64 &);
+
+    enum {
+        BUFFER_SIZE     = 16 << 20,     // Bytes of generated code
+        BLOCK_LENGTH    = 32,           // Most instructions in a block
+        BLOCK_BYTES     = 16384,        // Space reserved to emit a block
+        HOT_COUNT       = 16,           // Visits before a block is compiled
+        HEAT_BITS       = 12,
+        HEAT_SIZE       = 1 << HEAT_BITS,
+        HEAT_MASK       = HEAT_SIZE - 1
+    };
+
+    // Layout of a block exit, see exit()
+    enum {
+        EXIT_GUARD      = 9,            // Offset of the expected pc
+        EXIT_JUMP       = 23,           // Offset of the chained jump
+        EXIT_MISS       = 27            // Offset of the return to run()
+    };
+
+    // Places forward jumps out of translated code can go, see translate()
+    enum {
+        LABEL_MISS,                     // Run the instruction by its stub
+        LABEL_CHECK,                    // Check the pc for a taken branch
+        LABEL_DONE,                     // Go on to the next instruction
+        LABELS,
+        LABEL_JUMPS     = 8             // Most jumps to one label
+    };
+
+    // Runs one instruction, returns true if the block must be left
+    typedef bool (*STUB)(emu65x64 *emu);
+
+    template <unsigned int CODE> static bool exec(emu65x64 *emu);
+
+    static const STUB stubs[256];
+    static const char *const names[256];
+    static const char *const modes[256];
+
+    static bool isNamed(Byte opcode, const char *const *list);
+
+    Byte *find(Addr pc);
+    Byte *compile(Addr pc);
+    void chain(Byte *site, Addr pc);
+    void flush();
+    void protect(Byte *first, Addr size, bool writing);
+
+    inline bool finished() const;
+    inline bool leaving();
+
+    bool translate(Byte opcode, Qword operand, Addr pc);
+    void guard(unsigned int shift, bool wide);
+    void address(const char *mode, Qword operand, unsigned int size, const void *tlb);
+    void setnz(unsigned int size);
+    void retire(Addr pc, unsigned int cycles);
+
+    inline unsigned int offset(const void *field) const
+    {
+        return (unsigned int)((const Byte *)field - (const Byte *)emu);
+    }
+
+    void emit(Byte value);
+    void emit(const char *bytes, unsigned int count);
+    void emit32(unsigned int value);
+    void emit64(Qword value);
+    void field(const char *bytes, unsigned int count, const void *field);
+    void jump(Byte opcode, const Byte *target);
+    Byte *hole(Byte opcode);
+    void bind(Byte *site);
+    void forward(unsigned int label, Byte opcode);
+    void land(unsigned int label);
+    void exit();
+
+    emu65x64           *emu;            // The emulator being translated
+    Byte               *buffer;         // Generated code
+    Byte               *next;           // Free space in the buffer
+    Byte               *(*enter)(emu65x64 *, Byte *); // Runs a block
+    Byte               *stop;           // Leaves a block returning NULL
+    Byte               *leave;          // Leaves a block returning rax
+
+    Byte               *jumps[LABELS][LABEL_JUMPS]; // Jumps waiting for a label
+    unsigned int        waiting[LABELS]; // Number of jumps waiting for each
+
+    unsigned long       count;          // Instructions left in this run
+    bool                stale;          // Blocks must be discarded
+
+    Byte                heat[HEAT_SIZE]; // Visits to untranslated addresses
+
+    std::unordered_map<Addr, Byte *> blocks; // Block entry points, or NULL
+    std::unordered_set<Addr> pages;     // Pages holding translated code
+    std::unordered_set<Addr> writable;  // Pages left to the interpreter
+};
+
+#endif
+#endif
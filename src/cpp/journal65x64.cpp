@@ -0,0 +1,355 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+
+#include "journal65x64.hpp"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char journal65x64::MAGIC[8] = { '6', '5', 'x', '6', '4', 'J', 'N', 'L' };
+
+//==============================================================================
+
+// Create an idle journal stamping entries with the given cycle count and
+// keeping replaying up to date
+journal65x64::journal65x64(const unsigned long *clock, std::atomic<bool> *replaying)
+    : clock(clock), replaying(replaying), fd(-1), active(false), kept(false), recording(false),
+      diverged(false), failed(false), last(0), mark(0), before(0), reached(0), used(0),
+      offset(0), dropped(0)
+{
+    head.kind = 0;
+    head.when = ~0UL;
+    head.value = 0;
+}
+
+journal65x64::~journal65x64()
+{
+    close();
+}
+
+// Start logging to a new file at path. Returns false if it cannot be created.
+bool journal65x64::record(const char *path)
+{
+    Byte *to = buffer + sizeof(MAGIC);
+
+    close();
+
+    if ((fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return (false);
+
+    active = true;
+    recording = true;
+    diverged = false;
+    last = *clock;
+
+    memcpy(buffer, MAGIC, sizeof(MAGIC));
+    encode(to, last);
+    used = to - buffer;
+    publish();
+    return (true);
+}
+
+// Start feeding back the log at path. Returns false if it cannot be read or
+// was not recorded from the current cycle count.
+bool journal65x64::replay(const char *path)
+{
+    Qword start;
+
+    close();
+
+    if ((fd = ::open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return (false);
+
+    active = true;
+    recording = false;
+    diverged = false;
+    publish();
+
+    for (unsigned int index = 0; index < sizeof(MAGIC); ++index) {
+        if (fill() != MAGIC[index]) {
+            close();
+            return (false);
+        }
+    }
+    if (!decode(start) || start != *clock) {
+        close();
+        return (false);
+    }
+
+    last = start;
+    advance();
+    return (true);
+}
+
+// Finish recording or replaying. Returns false if some of a recording could
+// not be written.
+bool journal65x64::close()
+{
+    bool written;
+
+    if (fd >= 0) {
+        if (recording)
+            sync();
+        if (fd >= 0 && ::close(fd) != 0 && recording)
+            failed = true;
+        fd = -1;
+    }
+
+    written = !failed;
+    failed = false;
+
+    active = kept = false;
+    publish();
+    reached = 0;
+    used = offset = 0;
+    head.kind = 0;
+    head.when = ~0UL;
+
+    std::vector<Byte>().swap(memory);
+    dropped = 0;
+    return (written);
+}
+
+// Write out any buffered entries. If the log cannot be written the recording
+// ends there and false is returned, as close() will too.
+bool journal65x64::sync()
+{
+    size_t done = 0;
+
+    while (fd >= 0 && recording && done < used) {
+        ssize_t count = ::write(fd, buffer + done, used - done);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+
+        if (count <= 0) {
+            ::close(fd);
+            fd = -1;
+            active = false;
+            failed = true;
+            publish();
+            break;
+        }
+        done += count;
+    }
+    used = 0;
+    return (!failed);
+}
+
+// Log an input of the given kind at the current cycle
+void journal65x64::put(Byte kind, Qword value)
+{
+    Byte entry[ENTRY_BYTES];
+    Byte *to = entry;
+
+    *to++ = kind;
+    encode(to, *clock - last);
+    encode(to, value);
+    last = *clock;
+
+    if (kept)
+        memory.insert(memory.end(), entry, to);
+    else {
+        if (used > BUFFER_SIZE - ENTRY_BYTES)
+            sync();
+
+        memcpy(buffer + used, entry, to - entry);
+        used += to - entry;
+    }
+}
+
+// Read the value of the next entry, which should be of the given kind and
+// stamped with the current cycle. If it is not the replay has diverged from
+// the recording and is abandoned, returning false so that the caller uses a
+// live value instead. A journal kept in memory drops the rest of its entries
+// and records from here on.
+bool journal65x64::take(Byte kind, Qword &value)
+{
+    if (head.kind != kind || head.when != *clock) {
+        diverged = (head.kind != 0);
+        if (diverged)
+            reached = 0;
+        if (kept)
+            cut();
+        else
+            close();
+        return (false);
+    }
+
+    value = head.value;
+    advance();
+    return (true);
+}
+
+//==============================================================================
+// Kept Journals
+//------------------------------------------------------------------------------
+
+// Start logging to memory
+void journal65x64::keep()
+{
+    close();
+
+    active = true;
+    kept = true;
+    recording = true;
+    diverged = false;
+    last = *clock;
+    reached = 0;
+    publish();
+}
+
+// Return the position a kept journal has reached, setting stamp to the cycle
+// of the entry before it
+size_t journal65x64::tell(unsigned long &stamp) const
+{
+    if (recording) {
+        stamp = last;
+        return (dropped + memory.size());
+    }
+
+    stamp = before;
+    return (dropped + mark);
+}
+
+// Replay a kept journal from an earlier position given by tell(). Called
+// before the clock is wound back, so that the devices are known to have seen
+// everything up to the current cycle.
+void journal65x64::rewind(size_t position, unsigned long stamp)
+{
+    if (!kept || position < dropped)
+        return;
+
+    reached = std::max(reached, *clock);
+    recording = false;
+    diverged = false;
+    publish();
+    offset = position - dropped;
+    last = stamp;
+    advance();
+}
+
+// Drop the entries a kept journal has yet to replay and record from here on
+void journal65x64::cut()
+{
+    if (!kept || recording)
+        return;
+
+    memory.resize(mark);
+    last = before;
+    recording = true;
+    publish();
+    head.kind = 0;
+    head.when = ~0UL;
+}
+
+// Drop the entries of a kept journal before a position given by tell()
+void journal65x64::forget(size_t position)
+{
+    if (!kept || position <= dropped)
+        return;
+
+    size_t count = std::min(position - dropped, memory.size());
+
+    memory.erase(memory.begin(), memory.begin() + count);
+    dropped += count;
+
+    if (!recording) {
+        offset -= std::min(offset, count);
+        mark -= std::min(mark, count);
+    }
+}
+
+//==============================================================================
+// Encoding
+//------------------------------------------------------------------------------
+
+// Append a LEB128 number at to
+void journal65x64::encode(Byte *&to, Qword value)
+{
+    while (value >= 0x80) {
+        *to++ = (Byte)(value | 0x80);
+        value >>= 7;
+    }
+    *to++ = (Byte)value;
+}
+
+// Read a LEB128 number from the log. Returns false at the end of the log.
+bool journal65x64::decode(Qword &value)
+{
+    unsigned int shift = 0;
+    int data;
+
+    value = 0;
+    do {
+        if ((data = fill()) < 0 || shift > 63)
+            return (false);
+
+        value |= (Qword)(data & 0x7f) << shift;
+        shift += 7;
+    } while (data & 0x80);
+
+    return (true);
+}
+
+// Return the next byte of the log, or -1 at its end
+int journal65x64::fill()
+{
+    if (kept)
+        return (offset < memory.size() ? memory[offset++] : -1);
+
+    if (offset == used) {
+        ssize_t count = ::read(fd, buffer, BUFFER_SIZE);
+
+        if (count <= 0)
+            return (-1);
+
+        used = (size_t)count;
+        offset = 0;
+    }
+    return (buffer[offset++]);
+}
+
+// Read the entry after the head. At the end of the log a file replay ends
+// while a kept journal goes back to recording.
+void journal65x64::advance()
+{
+    Qword delta;
+    int kind;
+
+    mark = offset;
+    before = last;
+
+    if ((kind = fill()) <= 0 || !decode(delta) || !decode(head.value)) {
+        if (kept)
+            cut();
+        else
+            close();
+        return;
+    }
+
+    head.kind = (Byte)kind;
+    head.when = last += delta;
+}
@@ -0,0 +1,160 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+
+#ifndef JOURNAL65X64_H
+#define JOURNAL65X64_H
+
+#include "nozo65x64.hpp"
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+// The journal65x64 class logs the inputs that make a run non-deterministic,
+// each stamped with the cycle it arrived at, so that the run can be repeated
+// exactly by feeding them back.
+//
+// Entries are a kind byte, the cycles since the previous entry and a value,
+// both as LEB128 numbers, so most take three or four bytes. The file starts
+// with a magic number and the cycle count recording began at.
+//
+// A journal may also be kept in memory, where it can be replayed from any
+// earlier position and goes back to recording once the replay catches up.
+class journal65x64 :
+    public nozo65x64
+{
+public:
+    // Kinds of entry
+    enum {
+        ENTRY_INPUT     = 1,            // A byte read by WDM #$02
+        ENTRY_READ      = 2,            // A value read from an MMIO page
+        ENTRY_SERVICE   = 3,            // An interrupt line was serviced
+        ENTRY_WAKE      = 4             // STP/WAI was ended by an interrupt
+    };
+
+    journal65x64(const unsigned long *clock, std::atomic<bool> *replaying);
+    ~journal65x64();
+
+    bool record(const char *path);
+    bool replay(const char *path);
+    bool close();
+    bool sync();
+
+    void keep();
+    size_t tell(unsigned long &stamp) const;
+    void rewind(size_t position, unsigned long stamp);
+    void cut();
+    void forget(size_t position);
+
+    // Test if inputs are being logged
+    inline bool isRecording() const
+    {
+        return (active && recording);
+    }
+
+    // Test if inputs are being fed back
+    inline bool isReplaying() const
+    {
+        return (active && !recording);
+    }
+
+    // Test if the journal is held in memory
+    inline bool isKept() const
+    {
+        return (active && kept);
+    }
+
+    // Test if the run is going over ground the devices have already seen:
+    // while replaying, and on until a rewound kept journal reaches the cycle
+    // it was rewound from
+    inline bool isRepeating() const
+    {
+        return (active && (!recording || (kept && *clock < reached)));
+    }
+
+    // Test if a replay ended because the run no longer matched the log
+    inline bool hasDiverged() const
+    {
+        return (diverged);
+    }
+
+    void put(Byte kind, Qword value);
+    bool take(Byte kind, Qword &value);
+
+    // Return the kind of the next entry to replay and set when to its cycle
+    inline Byte next(unsigned long &when) const
+    {
+        when = head.when;
+        return (head.kind);
+    }
+
+private:
+    journal65x64(const journal65x64 &);
+    journal65x64 &operator=(const journal65x64 &);
+
+    enum {
+        BUFFER_SIZE     = 64 << 10,     // Bytes buffered between transfers
+        ENTRY_BYTES     = 1 + 10 + 10   // Longest encoded entry
+    };
+
+    static const char MAGIC[8];
+
+    // An entry read back from the log
+    struct ENTRY {
+        Byte            kind;           // Kind, or 0 at the end of the log
+        unsigned long   when;           // Cycle stamp
+        Qword           value;
+    };
+
+    // Copy whether entries are being fed back to the flag other threads test
+    inline void publish()
+    {
+        replaying->store(active && !recording, std::memory_order_release);
+    }
+
+    static void encode(Byte *&to, Qword value);
+    bool decode(Qword &value);
+    int fill();
+    void advance();
+
+    const unsigned long *clock;         // The cycle count of the emulator
+    std::atomic<bool>   *replaying;     // Set while replaying, for other threads
+    int                 fd;             // The log file, or -1
+    bool                active;         // Recording or replaying
+    bool                kept;           // Held in memory rather than a file
+    bool                recording;      // Writing rather than reading
+    bool                diverged;       // The replay stopped on a mismatch
+    bool                failed;         // Entries could not be written
+    unsigned long       last;           // Stamp of the previous entry
+    ENTRY               head;           // The next entry to replay
+    size_t              mark;           // Offset of the head entry
+    unsigned long       before;         // Stamp of the entry before the head
+    unsigned long       reached;        // Latest cycle a kept journal was rewound from
+
+    Byte                buffer[BUFFER_SIZE];
+    size_t              used;           // Bytes in the buffer
+    size_t              offset;         // Bytes of the buffer or memory consumed
+
+    std::vector<Byte>   memory;         // A journal kept in memory
+    size_t              dropped;        // Bytes forgotten from its start
+};
+#endif
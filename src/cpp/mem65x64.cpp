@@ -21,78 +21,1446 @@
 
 #include "mem65x64.hpp"
 
-mem65x64::Addr  mem65x64::memMask;
-mem65x64::Addr  mem65x64::ramSize;
+#include <algorithm>
+#include <new>
+#include <system_error>
 
-mem65x64::Byte   *mem65x64::pRAM;
-const mem65x64::Byte *mem65x64::pROM;
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+thread_local mem65x64 *mem65x64::current = NULL;
 
 //==============================================================================
 
-// Never used.
+// Create an empty memory map
 mem65x64::mem65x64()
-{ }
+    : journal(NULL), layout(0), memMask(~(Addr)0), ramSize(0), pRAM(NULL),
+      pROM(NULL), tracking(false), epoch(1), generation(1)
+{
+    root = new void *[TABLE_SIZE]();
+    flush();
+}
 
-// Never used.
+// Release any RAM allocated on our behalf
 mem65x64::~mem65x64()
-{ }
+{
+    if (current == this)
+        current = NULL;
+
+    freeTable(root, 3);
+    release();
+}
 
-// Sets up the memory areas using a dynamically allocated array
-void mem65x64::setMemory(Addr memMask, Addr ramSize, const Byte *pROM)
+// Sets up the memory areas using sparse RAM that is committed on first touch.
+// Returns false, leaving the memory map as it was, if the host refuses to
+// reserve the RAM.
+bool mem65x64::setMemory(Addr memMask, Addr ramSize, const Byte *pROM)
 {
-    setMemory(memMask, ramSize, new Byte[ramSize], pROM);
+    Byte *pRAM = reserve(ramSize);
+    SPARSE sparse = { pRAM, ramSize, MEMREF(), 0 };
+
+    if (!pRAM)
+        return (false);
+
+    setMemory(memMask, ramSize, pRAM, pROM);
+    owned.push_back(sparse);
+    return (true);
 }
 
-// Sets up the memory area using pre-allocated array
+// Sets up the memory area using pre-allocated array. RAM starts at zero and
+// ROM follows it up to the top of the mask. Any page holding both is handled
+// byte by byte.
 void mem65x64::setMemory(Addr memMask, Addr ramSize, Byte *pRAM, const Byte *pROM)
 {
-    mem65x64::memMask = memMask;
-    mem65x64::ramSize = ramSize;
-    mem65x64::pRAM = pRAM;
-    mem65x64::pROM = pROM;
+    Addr ramPages = ramSize >> PAGE_BITS;
+    Addr romPage = (ramSize + PAGE_MASK) >> PAGE_BITS;
+
+    release();
+
+    this->memMask = memMask;
+    this->ramSize = ramSize;
+    this->pRAM = pRAM;
+    this->pROM = pROM;
+
+    regions.clear();
+    files.clear();
+    devices.clear();
+
+    if (ramPages)
+        addRegion(0, ramPages - 1, pRAM, PAGE_RAM);
+    if (ramSize & PAGE_MASK)
+        addRegion(ramPages, ramPages, NULL, PAGE_SPLIT);
+    if (pROM && romPage <= (memMask >> PAGE_BITS))
+        addRegion(romPage, memMask >> PAGE_BITS,
+            (Byte *)pROM + ((romPage << PAGE_BITS) - ramSize), PAGE_ROM);
+
+    flush();
+}
+
+// Map size bytes of host memory at pHost as RAM at base
+void mem65x64::mapRam(Addr base, Addr size, Byte *pHost)
+{
+    if (size != 0) {
+        addRegion(base >> PAGE_BITS, (base + size - 1) >> PAGE_BITS, pHost, PAGE_RAM);
+        flush();
+    }
+}
+
+// Map size bytes of host memory at pHost as ROM at base
+void mem65x64::mapRom(Addr base, Addr size, const Byte *pHost)
+{
+    if (size != 0) {
+        addRegion(base >> PAGE_BITS, (base + size - 1) >> PAGE_BITS, (Byte *)pHost, PAGE_ROM);
+        flush();
+    }
+}
+
+// Map the file at path read-only as ROM at base. Its pages come straight
+// from the page cache as the guest reads them, so nothing is copied and
+// every process mapping the same file shares them.
+bool mem65x64::mapRomFile(Addr base, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    void *host = MAP_FAILED;
+
+    if (fd < 0)
+        return (false);
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        host = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (host == MAP_FAILED)
+        return (false);
+
+    ROMREF file(new ROMFILE);
+
+    file->host = (Byte *)host;
+    file->size = info.st_size;
+    files.push_back(file);
+
+    mapRom(base, file->size, file->host);
+    return (true);
+}
+
+// Remove the pages covering base to base + size - 1 from the address space
+void mem65x64::unmap(Addr base, Addr size)
+{
+    if (size != 0) {
+        addRegion(base >> PAGE_BITS, (base + size - 1) >> PAGE_BITS, NULL, PAGE_UNMAPPED);
+        flush();
+    }
+}
+
+// Map size bytes of zero filled RAM at base, committed as the guest uses it.
+// Returns false, mapping nothing, if the host refuses to reserve it.
+bool mem65x64::mapSparse(Addr base, Addr size)
+{
+    if (size != 0) {
+        SPARSE sparse = { reserve(size), size, MEMREF(), 0 };
+
+        if (!sparse.host)
+            return (false);
+
+        owned.push_back(sparse);
+        mapRam(base, size, sparse.host);
+    }
+    return (true);
+}
+
+// Send accesses to the pages covering base to base + size - 1 through the
+// ffi hooks instead of the host memory behind them
+void mem65x64::mapMmio(Addr base, Addr size)
+{
+    if (size != 0) {
+        addRegion(base >> PAGE_BITS, (base + size - 1) >> PAGE_BITS, NULL, PAGE_MMIO);
+        flush();
+    }
+}
+
+// Send accesses to the pages covering base to base + size - 1 to a device.
+// Like mapMmio the memory the pages hide stays visible to the fallbacks.
+void mem65x64::mapDevice(Addr base, Addr size, const DEVICE &device)
+{
+    if (size != 0) {
+        DEVREF copy(new DEVICE(device));
+
+        devices.push_back(copy);
+        addRegion(base >> PAGE_BITS, (base + size - 1) >> PAGE_BITS, NULL, PAGE_MMIO);
+        regions.back().device = copy.get();
+        flush();
+    }
+}
+
+// Count the reserved pages that the host has committed so far
+mem65x64::Addr mem65x64::getCommitted() const
+{
+    const size_t hostPage = sysconf(_SC_PAGESIZE);
+    const size_t chunk = 65536;
+    unsigned char resident[chunk];
+    Addr total = 0;
+
+    for (size_t index = 0; index < owned.size(); ++index) {
+        Byte *host = owned[index].host;
+        size_t pages = (owned[index].size + hostPage - 1) / hostPage;
+
+        while (pages != 0) {
+            size_t count = (pages < chunk) ? pages : chunk;
+
+            if (mincore(host, count * hostPage, resident) == 0) {
+                for (size_t page = 0; page < count; ++page)
+                    if (resident[page] & 1)
+                        total += hostPage;
+            }
+            host += count * hostPage;
+            pages -= count;
+        }
+    }
+    return (total);
+}
+
+// Count the reserved bytes that the host has committed as huge pages, from
+// the mappings listed in /proc/self/smaps
+mem65x64::Addr mem65x64::getHugeCommitted() const
+{
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    char line[256];
+    bool reserved = false;
+    Addr total = 0;
+
+    if (!smaps)
+        return (0);
+
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long long first, last, size;
+
+        if (sscanf(line, "%llx-%llx ", &first, &last) == 2) {
+            reserved = false;
+            for (size_t index = 0; index < owned.size(); ++index) {
+                Addr host = (Addr)owned[index].host;
+
+                if (!owned[index].file && first < host + owned[index].size && last > host)
+                    reserved = true;
+            }
+        }
+        else if (reserved && sscanf(line, "AnonHugePages: %llu kB", &size) == 1)
+            total += (Addr)size << 10;
+    }
+
+    fclose(smaps);
+    return (total);
+}
+
+//==============================================================================
+// Host Memory
+//------------------------------------------------------------------------------
+
+// Reserve zero filled host memory without committing any of it. The kernel
+// supplies a page when it is first touched. Anything of a huge page or more
+// is aligned to one and offered to the host for transparent huge pages,
+// which cut host TLB misses when the guest wanders over a large RAM. If the
+// host has them turned off it falls back to normal pages. Returns NULL if
+// the address space cannot be had.
+mem65x64::Byte *mem65x64::reserve(Addr size)
+{
+    Addr length = size ? size : 1;
+    Addr extra = (length >= HUGE_SIZE) ? HUGE_SIZE : 0;
+    void *host = mmap(NULL, length + extra, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (host == MAP_FAILED)
+        return (NULL);
+
+    if (extra) {
+        const Addr hostPage = sysconf(_SC_PAGESIZE);
+        Addr head = -(Addr)host & (HUGE_SIZE - 1);
+        Addr used = (length + hostPage - 1) & ~(hostPage - 1);
+
+        // Trim the slack either side of the aligned part
+        if (head)
+            munmap(host, head);
+        if (extra > head)
+            munmap((Byte *)host + head + used, extra - head);
+        host = (Byte *)host + head;
+
+#ifdef MADV_HUGEPAGE
+        madvise(host, used, MADV_HUGEPAGE);
+#endif
+    }
+    return ((Byte *)host);
+}
+
+// Give back all the memory reserved by this instance
+void mem65x64::release()
+{
+    for (size_t index = 0; index < owned.size(); ++index)
+        munmap(owned[index].host, owned[index].size ? owned[index].size : 1);
+
+    owned.clear();
+}
+
+// Unmap a ROM file once nothing uses it
+mem65x64::ROMFILE::~ROMFILE()
+{
+    munmap(host, size);
+}
+
+//==============================================================================
+// Images
+//------------------------------------------------------------------------------
+
+mem65x64::IMAGE::IMAGE()
+    : memMask(~(Addr)0), ramSize(0), pRAM(NULL), pROM(NULL)
+{ }
+
+mem65x64::IMAGE::~IMAGE()
+{ }
+
+// Close a memory file once no image or restored RAM uses it
+mem65x64::MEMFILE::~MEMFILE()
+{
+    close(fd);
+}
+
+// Copy the memory map and the contents of its RAM into image. Only host pages
+// that have ever been touched are copied, along with the data of any image
+// the RAM was itself restored from, so the file stays as sparse as the
+// memory. ROM and hooked pages are shared with the original. Throws
+// std::system_error if the file cannot be created or written.
+void mem65x64::capture(IMAGE &image)
+{
+    const Addr hostPage = sysconf(_SC_PAGESIZE);
+    std::vector<BLOCK> spans;
+
+    // Gather the host memory behind RAM in whole host pages, merging overlaps
+    // so that memory seen through more than one region stays shared
+    for (size_t index = 0; index < regions.size(); ++index) {
+        const REGION &region = regions[index];
+
+        if (region.kind == PAGE_RAM && region.host) {
+            Addr start = (Addr)region.host & ~(hostPage - 1);
+            Addr end = (Addr)region.host + ((region.last - region.first + 1) << PAGE_BITS);
+            BLOCK span = { (Byte *)start, ((end + hostPage - 1) & ~(hostPage - 1)) - start, 0 };
+
+            spans.push_back(span);
+        }
+    }
+    if (pRAM && ramSize) {
+        Addr start = (Addr)pRAM & ~(hostPage - 1);
+        Addr end = (Addr)pRAM + ramSize;
+        BLOCK span = { (Byte *)start, ((end + hostPage - 1) & ~(hostPage - 1)) - start, 0 };
+
+        spans.push_back(span);
+    }
+
+    std::sort(spans.begin(), spans.end(), [](const BLOCK &l, const BLOCK &r) {
+        return (l.host < r.host);
+    });
+
+    image.blocks.clear();
+    for (size_t index = 0; index < spans.size(); ++index) {
+        if (!image.blocks.empty()) {
+            BLOCK &last = image.blocks.back();
+
+            if (spans[index].host <= last.host + last.size) {
+                Byte *end = std::max(last.host + last.size, spans[index].host + spans[index].size);
+
+                last.size = end - last.host;
+                continue;
+            }
+        }
+        image.blocks.push_back(spans[index]);
+    }
+
+    int fd = memfd_create("emu65x64", MFD_CLOEXEC);
+
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "memfd_create");
+
+    image.file.reset(new MEMFILE);
+    image.file->fd = fd;
+
+    int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    Addr offset = 0;
+
+    for (size_t index = 0; index < image.blocks.size(); ++index) {
+        BLOCK &block = image.blocks[index];
+        Addr pages = block.size / hostPage;
+        std::vector<bool> used(pages, pagemap < 0);
+        const SPARSE *base = NULL;
+
+        block.offset = offset;
+        offset += block.size;
+
+        // Pages that are present or swapped out have been touched
+        if (pagemap >= 0) {
+            Qword entries[512];
+
+            for (Addr page = 0; page < pages; page += 512) {
+                Addr count = std::min(pages - page, (Addr)512);
+                off_t at = ((Addr)block.host / hostPage + page) * sizeof(Qword);
+
+                if (pread(pagemap, entries, count * sizeof(Qword), at) != (ssize_t)(count * sizeof(Qword))) {
+                    for (Addr entry = 0; entry < count; ++entry)
+                        used[page + entry] = true;
+                    continue;
+                }
+                for (Addr entry = 0; entry < count; ++entry)
+                    if (entries[entry] & ((Qword)3 << 62))
+                        used[page + entry] = true;
+            }
+        }
+
+        // Untouched pages of a restored image still hold its data
+        for (size_t owner = 0; owner < owned.size(); ++owner) {
+            const SPARSE &sparse = owned[owner];
+
+            if (sparse.file && block.host >= sparse.host &&
+                    block.host + block.size <= sparse.host + sparse.size)
+                base = &sparse;
+        }
+        if (base) {
+            off_t first = base->offset + (block.host - base->host);
+            off_t last = first + block.size;
+            off_t data = first;
+
+            while ((data = lseek(base->file->fd, data, SEEK_DATA)) >= 0 && data < last) {
+                off_t hole = std::min(lseek(base->file->fd, data, SEEK_HOLE), last);
+
+                for (off_t page = data - first; page < hole - first; page += hostPage)
+                    used[page / hostPage] = true;
+                data = hole;
+            }
+        }
+
+        // Copy runs of used pages, leaving holes for pages that are known to
+        // be zero
+        for (Addr page = 0; page < pages;) {
+            Addr count = 0;
+
+            while (page + count < pages && used[page + count]) {
+                const Byte *host = block.host + (page + count) * hostPage;
+
+                if (!base && host[0] == 0 && !memcmp(host, host + 1, hostPage - 1))
+                    break;
+                ++count;
+            }
+
+            if (count != 0) {
+                Addr done = 0;
+
+                while (done < count * hostPage) {
+                    ssize_t wrote = pwrite(fd, block.host + page * hostPage + done,
+                        count * hostPage - done, block.offset + page * hostPage + done);
+
+                    if (wrote <= 0) {
+                        int error = wrote < 0 ? errno : ENOSPC;
+
+                        if (pagemap >= 0)
+                            close(pagemap);
+                        throw std::system_error(error, std::generic_category(), "pwrite");
+                    }
+                    done += wrote;
+                }
+                page += count;
+            }
+            else
+                ++page;
+        }
+    }
+
+    if (pagemap >= 0)
+        close(pagemap);
+
+    if (ftruncate(fd, offset) != 0)
+        throw std::system_error(errno, std::generic_category(), "ftruncate");
+
+    image.regions = regions;
+    image.files = files;
+    image.devices = devices;
+    image.memMask = memMask;
+    image.ramSize = ramSize;
+    image.pRAM = pRAM;
+    image.pROM = pROM;
+}
+
+// Replace the memory map with a private copy of image. Its RAM is mapped
+// copy-on-write so this costs little more than one mapping per block, and
+// every copy shares the image's file descriptor. Throws std::system_error,
+// leaving the memory map as it was, if a block cannot be mapped.
+void mem65x64::restore(const IMAGE &image)
+{
+    std::vector<SPARSE> mapped;
+    std::vector<Byte *> hosts;
+
+    for (size_t index = 0; index < image.blocks.size(); ++index) {
+        const BLOCK &block = image.blocks[index];
+        void *host = mmap(NULL, block.size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_NORESERVE, image.file->fd, block.offset);
+
+        if (host == MAP_FAILED) {
+            int error = errno;
+
+            for (size_t done = 0; done < mapped.size(); ++done)
+                munmap(mapped[done].host, mapped[done].size);
+            throw std::system_error(error, std::generic_category(), "mmap");
+        }
+
+        SPARSE sparse = { (Byte *)host, block.size, image.file, block.offset };
+
+        mapped.push_back(sparse);
+        hosts.push_back((Byte *)host);
+    }
+
+    release();
+    owned.swap(mapped);
+
+    regions = image.regions;
+    files = image.files;
+    devices = image.devices;
+    for (size_t index = 0; index < regions.size(); ++index)
+        regions[index].host = translate(image, hosts, regions[index].host);
+
+    memMask = image.memMask;
+    ramSize = image.ramSize;
+    pRAM = translate(image, hosts, image.pRAM);
+    pROM = image.pROM;
+
+    flush();
+}
+
+// Find where a host address captured in image lives in its restored blocks.
+// Addresses outside the blocks are shared and stay as they are.
+mem65x64::Byte *mem65x64::translate(const IMAGE &image, const std::vector<Byte *> &hosts, const Byte *host)
+{
+    for (size_t index = 0; index < image.blocks.size(); ++index) {
+        const BLOCK &block = image.blocks[index];
+
+        if (host >= block.host && host < block.host + block.size)
+            return (hosts[index] + (host - block.host));
+    }
+    return ((Byte *)host);
+}
+
+//==============================================================================
+// Page Table
+//------------------------------------------------------------------------------
+
+// Record a region covering pages first to last
+void mem65x64::addRegion(Addr first, Addr last, Byte *pHost, Byte kind)
+{
+    REGION region = { first, last, pHost, kind, NULL };
+
+    regions.push_back(region);
+}
+
+// Forget all resolved pages after the regions have changed
+void mem65x64::flush()
+{
+    for (unsigned int index = 0; index < TABLE_SIZE; ++index) {
+        freeTable((void **)root[index], 2);
+        root[index] = NULL;
+    }
+
+    for (unsigned int index = 0; index < TLB_SIZE; ++index) {
+        rdTlb[index].tag = ~(Addr)0;
+        wrTlb[index].tag = ~(Addr)0;
+    }
+
+    // Saved pages may no longer be mapped
+    ++layout;
+    changed.clear();
+    before.clear();
+
+    codeChanged(0, ~(Addr)0);
+}
+
+// Release a page table level and everything below it
+void mem65x64::freeTable(void **table, unsigned int level)
+{
+    if (!table)
+        return;
+
+    for (unsigned int index = 0; index < TABLE_SIZE; ++index) {
+        if (level > 1)
+            freeTable((void **)table[index], level - 1);
+        else
+            delete[] (PAGE *)table[index];
+    }
+
+    delete[] table;
+}
+
+// Walk the page table for an address, resolving the page from the regions
+// the first time it is seen. Plain RAM and ROM pages are loaded into the TLB
+// so the inline accessors find them next time.
+mem65x64::PAGE &mem65x64::lookup(Addr ea)
+{
+    Addr vpn = (ea & memMask) >> PAGE_BITS;
+    void **table = root;
+
+    for (unsigned int level = 3; level > 1; --level) {
+        void *&next = table[(vpn >> (level * TABLE_BITS)) & TABLE_MASK];
+
+        if (!next)
+            next = new void *[TABLE_SIZE]();
+        table = (void **)next;
+    }
+
+    void *&leaf = table[(vpn >> TABLE_BITS) & TABLE_MASK];
+
+    if (!leaf)
+        leaf = new PAGE[TABLE_SIZE]();
+
+    PAGE &page = ((PAGE *)leaf)[vpn & TABLE_MASK];
+
+    if (page.kind == PAGE_UNKNOWN) {
+        page.kind = PAGE_UNMAPPED;
+        page.watch = watchKinds(vpn);
+
+        for (size_t index = regions.size(); index-- > 0;) {
+            const REGION &region = regions[index];
+
+            if (vpn < region.first || vpn > region.last)
+                continue;
+
+            Byte *host = region.host
+                ? region.host + ((vpn - region.first) << PAGE_BITS) : NULL;
+
+            if (page.kind == PAGE_UNMAPPED) {
+                page.kind = region.kind;
+                page.device = region.device;
+            }
+            if (region.kind == PAGE_RAM || region.kind == PAGE_ROM)
+                page.rd = host;
+            if (region.kind == PAGE_RAM)
+                page.wr = host;
+            if (region.kind != PAGE_MMIO)
+                break;
+        }
+    }
+
+    if (pageable()) {
+        Addr tag = ea >> PAGE_BITS;
+
+        if ((page.kind == PAGE_RAM || page.kind == PAGE_ROM) &&
+                !(page.watch & WATCH_READ)) {
+            rdTlb[tag & TLB_MASK].tag = tag;
+            rdTlb[tag & TLB_MASK].host = (Byte *)page.rd;
+        }
+        if (page.kind == PAGE_RAM && !page.code && page.dirtied == generation &&
+                (!tracking || page.epoch == epoch) && !(page.watch & WATCH_WRITE)) {
+            wrTlb[tag & TLB_MASK].tag = tag;
+            wrTlb[tag & TLB_MASK].host = page.wr;
+        }
+    }
+
+    return (page);
+}
+
+//==============================================================================
+// Code Pages
+//------------------------------------------------------------------------------
+
+// Mark the bytes from first to last as code. Write TLB entries for their
+// pages are dropped so that stores to them take the slow path.
+bool mem65x64::watchCode(Addr first, Addr last)
+{
+    for (Addr ea = first;; ++ea) {
+        PAGE &page = lookup(ea);
+
+        if (page.kind != PAGE_RAM && page.kind != PAGE_ROM)
+            return (false);
+
+        if (!page.code) {
+            for (unsigned int index = 0; index < TLB_SIZE; ++index) {
+                if (page.wr && wrTlb[index].host == page.wr)
+                    wrTlb[index].tag = ~(Addr)0;
+            }
+        }
+        page.code |= (Qword)1 << ((resolve(ea) & PAGE_MASK) >> CODE_BITS);
+
+        if (ea == last)
+            return (true);
+    }
+}
+
+// Check a store of size bytes at ea against the watched blocks of its page.
+// Blocks that are hit stop being watched until code is decoded from them again.
+void mem65x64::storeCode(PAGE &page, Addr ea, unsigned int size)
+{
+    Addr first = ~(Addr)0;
+    Addr last = 0;
+
+    for (unsigned int index = 0; index < size; ++index) {
+        Addr at = resolve(ea + index);
+        Qword block = (Qword)1 << ((at & PAGE_MASK) >> CODE_BITS);
+
+        if (page.code & block) {
+            page.code &= ~block;
+
+            if (first > (at & ~(Addr)(CODE_SIZE - 1)))
+                first = at & ~(Addr)(CODE_SIZE - 1);
+            if (last < (at | (CODE_SIZE - 1)))
+                last = at | (CODE_SIZE - 1);
+        }
+    }
+
+    if (first <= last)
+        codeChanged(first, last);
+}
+
+// Nothing caches code at this level
+void mem65x64::codeChanged(Addr, Addr)
+{ }
+
+//==============================================================================
+// Dirty Pages
+//------------------------------------------------------------------------------
+
+// A page only gets a write TLB entry once it has been marked dirty, so the
+// first store to it in each generation takes the slow path and comes here.
+// Stores after that cost nothing extra.
+void mem65x64::mark(PAGE &page, Addr ea)
+{
+    Addr vpn = resolve(ea) >> PAGE_BITS;
+
+    page.dirtied = generation;
+    if (page.kind == PAGE_RAM || page.kind == PAGE_SPLIT)
+        dirty[vpn >> 6] |= (Qword)1 << (vpn & 63);
+}
+
+// Report the dirty pages in a range as a bitmap
+mem65x64::Addr mem65x64::getDirty(Addr base, Addr size, Byte *bitmap) const
+{
+    Addr pages = size ? ((base + size - 1) >> PAGE_BITS) - (base >> PAGE_BITS) + 1 : 0;
+    Addr count = 0;
+
+    memset(bitmap, 0, (pages + 7) / 8);
+
+    for (Addr index = 0; index < pages; ++index) {
+        Addr vpn = resolve(base + (index << PAGE_BITS)) >> PAGE_BITS;
+        std::unordered_map<Addr, Qword>::const_iterator bits = dirty.find(vpn >> 6);
+
+        if (bits != dirty.end() && (bits->second & ((Qword)1 << (vpn & 63)))) {
+            bitmap[index / 8] |= 1 << (index % 8);
+            ++count;
+        }
+    }
+    return (count);
+}
+
+// Clear the dirty bits of the pages in a range. Every page is marked afresh
+// by its next store, which keeps the bits outside the range as they were.
+void mem65x64::clearDirty(Addr base, Addr size)
+{
+    Addr pages = size ? ((base + size - 1) >> PAGE_BITS) - (base >> PAGE_BITS) + 1 : 0;
+
+    for (Addr index = 0; index < pages && !dirty.empty(); ++index) {
+        Addr vpn = resolve(base + (index << PAGE_BITS)) >> PAGE_BITS;
+        std::unordered_map<Addr, Qword>::iterator bits = dirty.find(vpn >> 6);
+
+        if (bits != dirty.end() && !(bits->second &= ~((Qword)1 << (vpn & 63))))
+            dirty.erase(bits);
+    }
+
+    ++generation;
+    for (unsigned int index = 0; index < TLB_SIZE; ++index)
+        wrTlb[index].tag = ~(Addr)0;
+}
+
+//==============================================================================
+// Watchpoints
+//------------------------------------------------------------------------------
+
+// Watch a range of addresses for the given kinds of access. Pages already
+// resolved pick up the new watchpoint at once, the rest when first looked up.
+void mem65x64::setWatchpoint(Addr base, Addr size, unsigned int kinds)
+{
+    if (size == 0 || !(kinds &= WATCH_READ | WATCH_WRITE))
+        return;
+
+    if (base + size - 1 < base)
+        size = ~base + 1;
+
+    WATCH watch = { base, size, kinds };
+
+    watches.push_back(watch);
+    rewatch(root, 3, 0);
+}
+
+// Remove the watchpoints set by setWatchpoint for exactly this range
+void mem65x64::clearWatchpoint(Addr base, Addr size)
+{
+    if (base + size - 1 < base)
+        size = ~base + 1;
+
+    for (size_t index = watches.size(); index-- > 0;) {
+        if (watches[index].base == base && watches[index].size == size)
+            watches.erase(watches.begin() + index);
+    }
+    rewatch(root, 3, 0);
+}
+
+// Report an access to a watched page if it covers a watched byte
+void mem65x64::watched(Addr ea, unsigned int size, unsigned int kind)
+{
+    Addr first = resolve(ea);
+
+    for (size_t index = 0; index < watches.size(); ++index) {
+        const WATCH &watch = watches[index];
+        Addr base = resolve(watch.base);
+
+        if ((watch.kinds & kind) && first <= base + (watch.size - 1) &&
+                base <= first + (size - 1)) {
+            watchHit(ea, size, kind);
+            return;
+        }
+    }
+}
+
+// Return the kinds of watchpoint covering any part of a resolved page
+mem65x64::Byte mem65x64::watchKinds(Addr vpn) const
+{
+    Byte kinds = 0;
+
+    for (size_t index = 0; index < watches.size(); ++index) {
+        const WATCH &watch = watches[index];
+        Addr base = resolve(watch.base);
+
+        if ((base >> PAGE_BITS) <= vpn && vpn <= ((base + (watch.size - 1)) >> PAGE_BITS))
+            kinds |= (Byte)watch.kinds;
+    }
+    return (kinds);
+}
+
+// Work out the watchpoint kinds of every page resolved so far below a page
+// table level. TLB entries are dropped so that watched pages lose theirs.
+void mem65x64::rewatch(void **table, unsigned int level, Addr prefix)
+{
+    if (level == 3) {
+        for (unsigned int index = 0; index < TLB_SIZE; ++index) {
+            rdTlb[index].tag = ~(Addr)0;
+            wrTlb[index].tag = ~(Addr)0;
+        }
+    }
+
+    if (!table)
+        return;
+
+    for (unsigned int index = 0; index < TABLE_SIZE; ++index) {
+        Addr vpn = (prefix << TABLE_BITS) | index;
+
+        if (level > 1)
+            rewatch((void **)table[index], level - 1, vpn);
+        else if (table[index]) {
+            PAGE *pages = (PAGE *)table[index];
+
+            for (unsigned int page = 0; page < TABLE_SIZE; ++page) {
+                if (pages[page].kind != PAGE_UNKNOWN)
+                    pages[page].watch = watchKinds((vpn << TABLE_BITS) | page);
+            }
+        }
+    }
+}
+
+// Nothing is watching at this level
+void mem65x64::watchHit(Addr, unsigned int, unsigned int)
+{ }
+
+//==============================================================================
+// Undo Log
+//------------------------------------------------------------------------------
+
+// Start or stop saving pages before they are stored to
+void mem65x64::track(bool enable)
+{
+    UNDO undo;
+
+    tracking = enable;
+    seal(undo);
+}
+
+// Hand over the pages saved in this epoch and start the next one. Write TLB
+// entries are dropped so that the first store to each page is seen again.
+void mem65x64::seal(UNDO &undo)
+{
+    undo.blocks.swap(changed);
+    undo.data.swap(before);
+    changed.clear();
+    before.clear();
+
+    ++epoch;
+    for (unsigned int index = 0; index < TLB_SIZE; ++index)
+        wrTlb[index].tag = ~(Addr)0;
+}
+
+// Put back the pages saved in an epoch, the earliest copy of each last
+void mem65x64::apply(const UNDO &undo)
+{
+    for (size_t index = undo.blocks.size(); index-- > 0;) {
+        const BLOCK &block = undo.blocks[index];
+
+        memcpy(block.host, &undo.data[block.offset], block.size);
+    }
+
+    codeChanged(0, ~(Addr)0);
+}
+
+// Save the RAM behind a page for the undo log. The RAM part of a page split
+// with ROM is saved on its own.
+void mem65x64::save(PAGE &page, Addr ea)
+{
+    BLOCK block = { page.wr, PAGE_SIZE, before.size() };
+
+    if (!page.wr) {
+        Addr start = (ea & memMask) & ~(Addr)PAGE_MASK;
+
+        if (page.kind != PAGE_SPLIT || start >= ramSize)
+            return;
+
+        block.host = pRAM + start;
+        block.size = ramSize - start;
+    }
+
+    page.epoch = epoch;
+    changed.push_back(block);
+    before.insert(before.end(), block.host, block.host + block.size);
+}
+
+//==============================================================================
+// Slow Paths
+//------------------------------------------------------------------------------
+
+// Read size bytes from an MMIO page through its device or the ffi hooks.
+// While a journal is replaying the value logged for the read is used instead.
+mem65x64::Qword mem65x64::readMmio(const PAGE &page, Addr ea, unsigned int size)
+{
+    Qword value;
+
+    if (journal && journal->isReplaying() &&
+            journal->take(journal65x64::ENTRY_READ, value))
+        return (value);
+
+    if (page.device)
+        value = readDevice(*page.device, ea, size);
+    else {
+        switch (size) {
+        case 1:     value = read_byte((unsigned long long)ea);  break;
+        case 2:     value = read_word((unsigned long long)ea);  break;
+        case 4:     value = read_dword((unsigned long long)ea); break;
+        default:    value = read_qword((unsigned long long)ea); break;
+        }
+    }
+
+    if (journal && journal->isRecording())
+        journal->put(journal65x64::ENTRY_READ, value);
+
+    return (value);
+}
+
+// Write size bytes to an MMIO page through its device or the ffi hooks. While
+// a journal is replaying, or execution is repeated after going backwards, the
+// devices have already seen the write so it is dropped.
+void mem65x64::writeMmio(const PAGE &page, Addr ea, unsigned int size, Qword data)
+{
+    if (journal && journal->isRepeating())
+        return;
+
+    if (page.device) {
+        writeDevice(*page.device, ea, size, data);
+        return;
+    }
+
+    switch (size) {
+    case 1:     write_byte((unsigned long long)ea, (unsigned char)data);        break;
+    case 2:     write_word((unsigned long long)ea, (unsigned short)data);       break;
+    case 4:     write_dword((unsigned long long)ea, (unsigned long)data);       break;
+    default:    write_qword((unsigned long long)ea, (unsigned long long)data);  break;
+    }
+}
+
+// Read size bytes from a device, as two reads of half the size if it has no
+// handler for them. Only the low 32 bits of a dword handler's result count.
+mem65x64::Qword mem65x64::readDevice(const DEVICE &device, Addr ea, unsigned int size)
+{
+    switch (size) {
+    case 1:
+        return (device.readByte ? device.readByte(device.context, ea) : 0);
+    case 2:
+        if (device.readWord)
+            return (device.readWord(device.context, ea));
+        break;
+    case 4:
+        if (device.readDword)
+            return ((unsigned int)device.readDword(device.context, ea));
+        break;
+    default:
+        if (device.readQword)
+            return (device.readQword(device.context, ea));
+        break;
+    }
+
+    size /= 2;
+    return (readDevice(device, ea, size) |
+        (readDevice(device, ea + size, size) << (8 * size)));
+}
+
+// Write size bytes to a device, as two writes of half the size if it has no
+// handler for them
+void mem65x64::writeDevice(const DEVICE &device, Addr ea, unsigned int size, Qword data)
+{
+    switch (size) {
+    case 1:
+        if (device.writeByte)
+            device.writeByte(device.context, ea, (Byte)data);
+        return;
+    case 2:
+        if (device.writeWord) {
+            device.writeWord(device.context, ea, (Word)data);
+            return;
+        }
+        break;
+    case 4:
+        if (device.writeDword) {
+            device.writeDword(device.context, ea, lo_d(data));
+            return;
+        }
+        break;
+    default:
+        if (device.writeQword) {
+            device.writeQword(device.context, ea, data);
+            return;
+        }
+        break;
+    }
+
+    size /= 2;
+    writeDevice(device, ea, size, data);
+    writeDevice(device, ea + size, size, data >> (8 * size));
+}
+
+// Fetch a byte that missed the TLB
+mem65x64::Byte mem65x64::getByteSlow(Addr ea)
+{
+    const PAGE &page = lookup(ea);
+
+    check(page, ea, 1, WATCH_READ);
+    if (page.kind == PAGE_MMIO)
+        return ((Byte)readMmio(page, ea, 1));
+
+    return (getByteF(ea));
+}
+
+// Fetch a word that missed the TLB or crosses a page
+mem65x64::Word mem65x64::getWordSlow(Addr ea)
+{
+    if ((ea & PAGE_MASK) > PAGE_SIZE - 2)
+        return (join_w(getByte(ea + 0), getByte(ea + 1)));
+
+    const PAGE &page = lookup(ea);
+
+    check(page, ea, 2, WATCH_READ);
+    if (page.kind == PAGE_MMIO)
+        return ((Word)readMmio(page, ea, 2));
+
+    return (getWordF(ea));
+}
+
+// Fetch a dword that missed the TLB or crosses a page
+mem65x64::Dword mem65x64::getDwordSlow(Addr ea)
+{
+    if ((ea & PAGE_MASK) > PAGE_SIZE - 4)
+        return (join_d(getWord(ea + 0), getWord(ea + 2)));
+
+    const PAGE &page = lookup(ea);
+
+    check(page, ea, 4, WATCH_READ);
+    if (page.kind == PAGE_MMIO)
+        return ((Dword)readMmio(page, ea, 4));
+
+    return (getDwordF(ea));
+}
+
+// Fetch a qword that missed the TLB or crosses a page
+mem65x64::Qword mem65x64::getQwordSlow(Addr ea)
+{
+    if ((ea & PAGE_MASK) > PAGE_SIZE - 8)
+        return (join_q(getDword(ea + 0), getDword(ea + 4)));
+
+    const PAGE &page = lookup(ea);
+
+    check(page, ea, 8, WATCH_READ);
+    if (page.kind == PAGE_MMIO)
+        return ((Qword)readMmio(page, ea, 8));
+
+    return (getQwordF(ea));
+}
+
+// Write a byte that missed the TLB
+void mem65x64::setByteSlow(Addr ea, Byte data)
+{
+    const PAGE &page = lookup(ea);
+
+    check(page, ea, 1, WATCH_WRITE);
+    if (page.kind == PAGE_MMIO)
+        writeMmio(page, ea, 1, data);
+    else
+        setByteF(ea, data);
+}
+
+// Write a word that missed the TLB or crosses a page
+void mem65x64::setWordSlow(Addr ea, Word data)
+{
+    if ((ea & PAGE_MASK) > PAGE_SIZE - 2) {
+        setByte(ea + 0, lo_b(data));
+        setByte(ea + 1, hi_b(data));
+    }
+    else {
+        PAGE &page = lookup(ea);
+
+        check(page, ea, 2, WATCH_WRITE);
+        if (page.kind == PAGE_MMIO)
+            writeMmio(page, ea, 2, data);
+        else if (page.wr && pageable()) {
+            if (page.code)
+                storeCode(page, ea, 2);
+            touch(page, ea);
+            store_w(page.wr + (ea & PAGE_MASK), data);
+        }
+        else
+            setWordF(ea, data);
+    }
+}
+
+// Write a dword that missed the TLB or crosses a page
+void mem65x64::setDwordSlow(Addr ea, Dword data)
+{
+    if ((ea & PAGE_MASK) > PAGE_SIZE - 4) {
+        setWord(ea + 0, lo_w(data));
+        setWord(ea + 2, hi_w(data));
+    }
+    else {
+        PAGE &page = lookup(ea);
+
+        check(page, ea, 4, WATCH_WRITE);
+        if (page.kind == PAGE_MMIO)
+            writeMmio(page, ea, 4, data);
+        else if (page.wr && pageable()) {
+            if (page.code)
+                storeCode(page, ea, 4);
+            touch(page, ea);
+            store_d(page.wr + (ea & PAGE_MASK), data);
+        }
+        else
+            setDwordF(ea, data);
+    }
+}
+
+// Write a qword that missed the TLB or crosses a page
+void mem65x64::setQwordSlow(Addr ea, Qword data)
+{
+    if ((ea & PAGE_MASK) > PAGE_SIZE - 8) {
+        setDword(ea + 0, lo_d(data));
+        setDword(ea + 4, hi_d(data));
+    }
+    else {
+        PAGE &page = lookup(ea);
+
+        check(page, ea, 8, WATCH_WRITE);
+        if (page.kind == PAGE_MMIO)
+            writeMmio(page, ea, 8, data);
+        else if (page.wr && pageable()) {
+            if (page.code)
+                storeCode(page, ea, 8);
+            touch(page, ea);
+            store_q(page.wr + (ea & PAGE_MASK), data);
+        }
+        else
+            setQwordF(ea, data);
+    }
+}
+
+//==============================================================================
+// Block Moves
+//------------------------------------------------------------------------------
+
+// Copy up to count bytes from src to dst, stopping at the first page boundary
+// either side reaches. When down is set the addresses are those of the last
+// bytes and the copy runs towards lower addresses. Pages of plain RAM (or ROM
+// as the source) are copied directly, anything else a byte at a time.
+mem65x64::Addr mem65x64::moveBytes(Addr dst, Addr src, Addr count, bool down)
+{
+    Addr room = down
+        ? std::min(src & PAGE_MASK, dst & PAGE_MASK) + 1
+        : PAGE_SIZE - std::max(src & PAGE_MASK, dst & PAGE_MASK);
+
+    if (count > room)
+        count = room;
+
+    if (down) {
+        src -= count - 1;
+        dst -= count - 1;
+    }
+
+    if (pageable()) {
+        PAGE &from = lookup(src);
+        PAGE &to = lookup(dst);
+
+        if ((from.kind == PAGE_RAM || from.kind == PAGE_ROM) && to.kind == PAGE_RAM) {
+            check(from, src, (unsigned int)count, WATCH_READ);
+            check(to, dst, (unsigned int)count, WATCH_WRITE);
+            if (to.code)
+                storeCode(to, dst, (unsigned int)count);
+            touch(to, dst);
+            copy(to.wr + (dst & PAGE_MASK), from.rd + (src & PAGE_MASK), count, down);
+            return (count);
+        }
+    }
+
+    if (down) {
+        for (Addr index = count; index-- > 0;)
+            setByte(dst + index, getByte(src + index));
+    }
+    else {
+        for (Addr index = 0; index < count; ++index)
+            setByte(dst + index, getByte(src + index));
+    }
+    return (count);
+}
+
+// Copy count bytes between host buffers as a byte at a time loop would. If
+// the destination starts inside the part of the source the loop has yet to
+// read, the bytes it has already written are read again, repeating the gap
+// between them. Otherwise this is the same as memmove.
+void mem65x64::copy(Byte *dst, const Byte *src, Addr count, bool down)
+{
+    Addr gap;
+
+    if (!down && dst > src && (gap = (Addr)(dst - src)) < count) {
+        for (Addr done = 0; done < count; done += gap)
+            memcpy(dst + done, src + done, std::min(gap, count - done));
+    }
+    else if (down && src > dst && (gap = (Addr)(src - dst)) < count) {
+        for (Addr done = 0; done < count; done += gap) {
+            Addr size = std::min(gap, count - done);
+
+            memcpy(dst + count - done - size, src + count - done - size, size);
+        }
+    }
+    else
+        memmove(dst, src, count);
+}
+
+//==============================================================================
+// Fallbacks
+//------------------------------------------------------------------------------
+
+// Fetch a byte from memory
+mem65x64::Byte mem65x64::getByteF(Addr ea)
+{
+    const PAGE &page = lookup(ea);
+
+    ea &= memMask;
+
+    if (page.rd)
+        return (page.rd[ea & PAGE_MASK]);
+
+    if (page.kind == PAGE_SPLIT) {
+        if (ea < ramSize)
+            return (pRAM[ea]);
+        if (pROM)
+            return (pROM[ea - ramSize]);
+    }
+    return (0);
+}
+
+// Fetch a word from memory
+mem65x64::Word mem65x64::getWordF(Addr ea)
+{
+    const Byte *host = readable(ea, 2);
+
+    if (host)
+        return (load_w(host));
+
+    return (join_w(getByteF(ea + 0), getByteF(ea + 1)));
+}
+
+// Fetch a dword from memory
+mem65x64::Dword mem65x64::getDwordF(Addr ea)
+{
+    const Byte *host = readable(ea, 4);
+
+    if (host)
+        return (load_d(host));
+
+    return (join_d(getWordF(ea + 0), getWordF(ea + 2)));
+}
+
+// Fetch a qword from memory
+mem65x64::Qword mem65x64::getQwordF(Addr ea)
+{
+    const Byte *host = readable(ea, 8);
+
+    if (host)
+        return (load_q(host));
+
+    return (join_q(getDwordF(ea + 0), getDwordF(ea + 4)));
+}
+
+// Write a byte to memory
+void mem65x64::setByteF(Addr ea, Byte data)
+{
+    PAGE &page = lookup(ea);
+
+    if (page.code)
+        storeCode(page, ea, 1);
+    touch(page, ea);
+
+    ea &= memMask;
+
+    if (page.wr)
+        page.wr[ea & PAGE_MASK] = data;
+    else if (page.kind == PAGE_SPLIT && ea < ramSize)
+        pRAM[ea] = data;
+}
+
+// Write a word to memory
+void mem65x64::setWordF(Addr ea, Word data)
+{
+    Byte *host = writable(ea, 2);
+
+    if (host)
+        store_w(host, data);
+    else {
+        setByteF(ea + 0, lo_b(data));
+        setByteF(ea + 1, hi_b(data));
+    }
+}
+
+// Write a dword to memory
+void mem65x64::setDwordF(Addr ea, Dword data)
+{
+    Byte *host = writable(ea, 4);
+
+    if (host)
+        store_d(host, data);
+    else {
+        setWordF(ea + 0, lo_w(data));
+        setWordF(ea + 2, hi_w(data));
+    }
+}
+
+// Write a qword to memory
+void mem65x64::setQwordF(Addr ea, Qword data)
+{
+    Byte *host = writable(ea, 8);
+
+    if (host)
+        store_q(host, data);
+    else {
+        setDwordF(ea + 0, lo_d(data));
+        setDwordF(ea + 4, hi_d(data));
+    }
+}
+
+// Return where the size bytes at ea are held together in host memory that
+// can be read, or NULL if they cross a page or a region, or memMask folds
+// them apart
+const mem65x64::Byte *mem65x64::readable(Addr ea, unsigned int size)
+{
+    const PAGE &page = lookup(ea);
+    Addr first = ea & memMask;
+
+    if ((first & PAGE_MASK) > PAGE_SIZE - size ||
+            ((ea + size - 1) & memMask) != first + size - 1)
+        return (NULL);
+
+    if (page.rd)
+        return (page.rd + (first & PAGE_MASK));
+
+    if (page.kind == PAGE_SPLIT) {
+        if (first + size <= ramSize)
+            return (pRAM + first);
+        if (first >= ramSize && pROM)
+            return (pROM + (first - ramSize));
+    }
+    return (NULL);
+}
+
+// Return where the size bytes at ea are held together in host memory that
+// can be written, as for readable(). The store is noted for translated code
+// and the undo log first.
+mem65x64::Byte *mem65x64::writable(Addr ea, unsigned int size)
+{
+    PAGE &page = lookup(ea);
+    Addr first = ea & memMask;
+    Byte *host;
+
+    if ((first & PAGE_MASK) > PAGE_SIZE - size ||
+            ((ea + size - 1) & memMask) != first + size - 1)
+        return (NULL);
+
+    if (page.wr)
+        host = page.wr + (first & PAGE_MASK);
+    else if (page.kind == PAGE_SPLIT && first + size <= ramSize)
+        host = pRAM + first;
+    else
+        return (NULL);
+
+    if (page.code)
+        storeCode(page, ea, size);
+    touch(page, ea);
+
+    return (host);
 }
 
 extern "C" {
-    // Internal fallbacks
+    // Internal fallbacks, applied to the memory bound to the calling thread
 
     unsigned char mem65x64_getByteF(unsigned long long addr)
     {
-        return (mem65x64::Byte)mem65x64::getByteF((mem65x64::Addr)addr);
+        return (mem65x64::Byte)mem65x64::bound()->getByteF((mem65x64::Addr)addr);
     }
 
     unsigned short mem65x64_getWordF(unsigned long long addr)
     {
-        return (mem65x64::Word)mem65x64::getWordF((mem65x64::Addr)addr);
+        return (mem65x64::Word)mem65x64::bound()->getWordF((mem65x64::Addr)addr);
     }
 
     unsigned long mem65x64_getDwordF(unsigned long long addr)
     {
-        return (mem65x64::Dword)mem65x64::getDwordF((mem65x64::Addr)addr);
+        return (mem65x64::Dword)mem65x64::bound()->getDwordF((mem65x64::Addr)addr);
     }
 
     unsigned long long mem65x64_getQwordF(unsigned long long addr)
     {
-        return (mem65x64::Qword)mem65x64::getQwordF((mem65x64::Addr)addr);
+        return (mem65x64::Qword)mem65x64::bound()->getQwordF((mem65x64::Addr)addr);
     }
 
     void mem65x64_setByteF(unsigned long long addr, unsigned char data)
     {
-        mem65x64::setByteF((mem65x64::Addr)addr, (mem65x64::Byte)data);
+        mem65x64::bound()->setByteF((mem65x64::Addr)addr, (mem65x64::Byte)data);
     }
 
     void mem65x64_setWordF(unsigned long long addr, unsigned short data)
     {
-        mem65x64::setWordF((mem65x64::Addr)addr, (mem65x64::Word)data);
+        mem65x64::bound()->setWordF((mem65x64::Addr)addr, (mem65x64::Word)data);
     }
 
     void mem65x64_setDwordF(unsigned long long addr, unsigned long data)
     {
-        mem65x64::setDwordF((mem65x64::Addr)addr, (mem65x64::Dword)data);
+        mem65x64::bound()->setDwordF((mem65x64::Addr)addr, (mem65x64::Dword)data);
     }
 
     void mem65x64_setQwordF(unsigned long long addr, unsigned long long data)
     {
-        mem65x64::setQwordF((mem65x64::Addr)addr, (mem65x64::Qword)data);
+        mem65x64::bound()->setQwordF((mem65x64::Addr)addr, (mem65x64::Qword)data);
     }
 }
 
@@ -23,6 +23,12 @@
 #define MEM65X64_H
 
 #include "nozo65x64.hpp"
+#include "journal65x64.hpp"
+
+#include <stddef.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 // The mem65x64 class defines a set of standard methods for defining and accessing
 // the emulated memory area.
@@ -45,131 +51,478 @@ class mem65x64 :
     public nozo65x64
 {
 public:
-    // Define the memory areas and sizes
-    static void setMemory (Addr memMask, Addr ramSize, const Byte *pROM);
-    static void setMemory (Addr memMask, Addr ramSize, Byte *pRAM, const Byte *pROM);
+    // Memory is mapped in pages of PAGE_SIZE bytes
+    enum {
+        PAGE_BITS       = 12,
+        PAGE_SIZE       = 1 << PAGE_BITS,
+        PAGE_MASK       = PAGE_SIZE - 1
+    };
+
+    // Define the memory areas and sizes. The sparse RAM form returns false if
+    // the host cannot reserve the RAM.
+    bool setMemory (Addr memMask, Addr ramSize, const Byte *pROM);
+    void setMemory (Addr memMask, Addr ramSize, Byte *pRAM, const Byte *pROM);
+
+    // Place a region anywhere in the 64-bit address space. Regions cover whole
+    // pages and a later region hides any earlier one it overlaps.
+    void mapRam(Addr base, Addr size, Byte *pHost);
+    void mapRom(Addr base, Addr size, const Byte *pHost);
+    void unmap(Addr base, Addr size);
+
+    // Map a ROM image file at base without reading it in. Returns false if
+    // it cannot be opened or is empty.
+    bool mapRomFile(Addr base, const char *path);
+
+    // Map size bytes of zero filled RAM at base. The host address space is
+    // reserved up front but pages are only committed when first touched.
+    // Returns false if the host cannot reserve that much.
+    bool mapSparse(Addr base, Addr size);
+
+    // Route the pages covering an address range through the ffi hooks
+    void mapMmio(Addr base, Addr size);
+
+    // The handlers of a device on the bus, each given the context and the
+    // address of an access. A width without a handler is made of two accesses
+    // of half the size. Without a byte handler reads give zero and writes are
+    // ignored.
+    struct DEVICE {
+        void           *context;
+        Byte          (*readByte)(void *context, Addr ea);
+        Word          (*readWord)(void *context, Addr ea);
+        Dword         (*readDword)(void *context, Addr ea);
+        Qword         (*readQword)(void *context, Addr ea);
+        void          (*writeByte)(void *context, Addr ea, Byte data);
+        void          (*writeWord)(void *context, Addr ea, Word data);
+        void          (*writeDword)(void *context, Addr ea, Dword data);
+        void          (*writeQword)(void *context, Addr ea, Qword data);
+    };
+
+    // Route the pages covering an address range to a device's handlers
+    // instead of the ffi hooks. The handlers are copied but the context
+    // must outlive the mapping, and any snapshot or fork that shares it.
+    void mapDevice(Addr base, Addr size, const DEVICE &device);
+
+    // Return the number of bytes of reserved RAM actually committed by the host
+    Addr getCommitted() const;
+
+    // Return how much of that the host backs with huge pages
+    Addr getHugeCommitted() const;
+
+    // Fill bitmap with a bit for each page from base to base + size - 1, set
+    // if the guest has stored to RAM in it since the bit was last cleared,
+    // and return how many are set. Bit n is bit n % 8 of byte n / 8.
+    Addr getDirty(Addr base, Addr size, Byte *bitmap) const;
+    void clearDirty(Addr base, Addr size);
+
+    // Kinds of access a watchpoint catches
+    enum {
+        WATCH_READ      = 1 << 0,
+        WATCH_WRITE     = 1 << 1
+    };
+
+    // Report the guest's accesses of the given kinds to any of the bytes from
+    // base to base + size - 1 to watchHit. Only pages holding watched bytes
+    // lose their TLB entries, so accesses elsewhere cost nothing extra.
+    void setWatchpoint(Addr base, Addr size, unsigned int kinds);
+    void clearWatchpoint(Addr base, Addr size);
+
+    // Make this the memory seen by the ffi fallbacks on the calling thread
+    inline void bind()
+    {
+        current = this;
+    }
+
+    // Return the memory bound to the calling thread
+    inline static mem65x64 *bound()
+    {
+        return (current);
+    }
 
     // Fetch a byte from memory
-    inline static Byte getByte(Addr ea)
+    inline Byte getByte(Addr ea)
     {
-        return (Byte)read_byte((unsigned long long)ea);
+        const TLB &entry = rdTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS))
+            return (entry.host[ea & PAGE_MASK]);
+
+        return (getByteSlow(ea));
     }
 
     // Fetch a word from memory
-    inline static Word getWord(Addr ea)
+    inline Word getWord(Addr ea)
     {
-        return (Word)read_word((unsigned long long)ea);
+        const TLB &entry = rdTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS) && (ea & PAGE_MASK) <= PAGE_SIZE - 2)
+            return (load_w(entry.host + (ea & PAGE_MASK)));
+
+        return (getWordSlow(ea));
     }
 
     // Fetch a dword from memory
-    inline static Dword getDword(Addr ea)
+    inline Dword getDword(Addr ea)
     {
-        return (Dword)read_dword((unsigned long long)ea);
+        const TLB &entry = rdTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS) && (ea & PAGE_MASK) <= PAGE_SIZE - 4)
+            return (load_d(entry.host + (ea & PAGE_MASK)));
+
+        return (getDwordSlow(ea));
     }
 
     // Fetch a qword from memory
-    inline static Qword getQword(Addr ea)
+    inline Qword getQword(Addr ea)
     {
-        return (Qword)read_qword((unsigned long long)ea);
+        const TLB &entry = rdTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS) && (ea & PAGE_MASK) <= PAGE_SIZE - 8)
+            return (load_q(entry.host + (ea & PAGE_MASK)));
+
+        return (getQwordSlow(ea));
     }
 
     // Fetch a long address from memory
-    inline static Addr getAddr(Addr ea)
+    inline Addr getAddr(Addr ea)
     {
         return (Addr)getQword(ea);
     }
 
     // Write a byte to memory
-    inline static void setByte(Addr ea, Byte data)
+    inline void setByte(Addr ea, Byte data)
     {
-        write_byte((unsigned long long)ea, (unsigned char)data);
+        const TLB &entry = wrTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS))
+            entry.host[ea & PAGE_MASK] = data;
+        else
+            setByteSlow(ea, data);
     }
 
     // Write a word to memory
-    inline static void setWord(Addr ea, Word data)
+    inline void setWord(Addr ea, Word data)
     {
-        write_word((unsigned long long)ea, (unsigned short)data);
+        const TLB &entry = wrTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS) && (ea & PAGE_MASK) <= PAGE_SIZE - 2)
+            store_w(entry.host + (ea & PAGE_MASK), data);
+        else
+            setWordSlow(ea, data);
     }
 
     // Write a dword to memory
-    inline static void setDword(Addr ea, Dword data)
+    inline void setDword(Addr ea, Dword data)
     {
-        write_dword((unsigned long long)ea, (unsigned long)data);
+        const TLB &entry = wrTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS) && (ea & PAGE_MASK) <= PAGE_SIZE - 4)
+            store_d(entry.host + (ea & PAGE_MASK), data);
+        else
+            setDwordSlow(ea, data);
     }
 
     // Write a qword to memory
-    inline static void setQword(Addr ea, Qword data)
+    inline void setQword(Addr ea, Qword data)
     {
-        write_qword((unsigned long long)ea, (unsigned long long)data);
+        const TLB &entry = wrTlb[(ea >> PAGE_BITS) & TLB_MASK];
+
+        if (entry.tag == (ea >> PAGE_BITS) && (ea & PAGE_MASK) <= PAGE_SIZE - 8)
+            store_q(entry.host + (ea & PAGE_MASK), data);
+        else
+            setQwordSlow(ea, data);
     }
 
-    // Fallbacks that use pRAM and pROM directly
+    // Fallbacks that bypass the TLB and the ffi hooks
+    Byte getByteF(Addr ea);
+    Word getWordF(Addr ea);
+    Dword getDwordF(Addr ea);
+    Qword getQwordF(Addr ea);
 
-    // Fetch a byte from memory
-    inline static Byte getByteF(Addr ea)
-    {
-        if ((ea &= memMask) < ramSize)
-            return (pRAM[ea]);
+    void setByteF(Addr ea, Byte data);
+    void setWordF(Addr ea, Word data);
+    void setDwordF(Addr ea, Dword data);
+    void setQwordF(Addr ea, Qword data);
 
-        return (pROM[ea - ramSize]);
-    }
+    // Copy up to count bytes from src to dst with the result of a getByte and
+    // setByte loop running upwards, or downwards from the given addresses if
+    // down is set. Stops where either side crosses a page and returns the
+    // number of bytes copied.
+    Addr moveBytes(Addr dst, Addr src, Addr count, bool down);
 
-    // Fetch a word from memory
-    inline static Word getWordF(Addr ea)
-    {
-        return (join_w(getByteF(ea + 0), getByteF(ea + 1)));
-    }
+protected:
+    mem65x64();
+    virtual ~mem65x64();
 
-    // Fetch a dword from memory
-    inline static Dword getDwordF(Addr ea)
-    {
-        return (join_d(getWordF(ea + 0), getWordF(ea + 2)));
-    }
+    // Mark the bytes from first to last as code so that stores to them are
+    // reported to codeChanged. Returns false unless they are RAM or ROM.
+    bool watchCode(Addr first, Addr last);
 
-    // Fetch a qword from memory
-    inline static Qword getQwordF(Addr ea)
-    {
-        return (join_q(getDwordF(ea + 0), getDwordF(ea + 4)));
-    }
+    // Called with the range of resolved addresses that a store to watched code
+    // may have changed. The whole range is given if the memory map changes.
+    virtual void codeChanged(Addr first, Addr last);
 
-    // Write a byte to memory
-    inline static void setByteF(Addr ea, Byte data)
+    // Called after a guest access of size bytes at ea, once the bytes it
+    // covers have been found to be watched for that kind of access
+    virtual void watchHit(Addr ea, unsigned int size, unsigned int kind);
+
+    struct IMAGE;
+
+    void capture(IMAGE &image);
+    void restore(const IMAGE &image);
+
+    journal65x64       *journal;        // Logs or replays MMIO reads, if set
+
+    struct UNDO;
+
+    void track(bool enable);
+    void seal(UNDO &undo);
+    void apply(const UNDO &undo);
+
+    unsigned long       layout;         // Changes each time the memory map does
+
+    // Return the address an access to ea resolves to
+    inline Addr resolve(Addr ea) const
     {
-        if ((ea &= memMask) < ramSize)
-            pRAM[ea] = data;
+        return (ea & memMask);
     }
 
-    // Write a word to memory
-    inline static void setWordF(Addr ea, Word data)
+private:
+    mem65x64(const mem65x64 &);
+    mem65x64 &operator=(const mem65x64 &);
+
+    // The translator emits the TLB lookups inline
+    friend class jit65x64;
+
+    // Software TLB geometry
+    enum {
+        TLB_BITS        = 8,
+        TLB_SIZE        = 1 << TLB_BITS,
+        TLB_MASK        = TLB_SIZE - 1
+    };
+
+    // Code is watched in blocks of CODE_SIZE bytes, one bit per block
+    enum {
+        CODE_BITS       = PAGE_BITS - 6,
+        CODE_SIZE       = 1 << CODE_BITS
+    };
+
+    // Reserved RAM is aligned to host huge pages of HUGE_SIZE bytes
+    enum {
+        HUGE_SIZE       = 2 << 20
+    };
+
+    // Page table geometry, four levels of TABLE_BITS page number bits
+    enum {
+        TABLE_BITS      = 13,
+        TABLE_SIZE      = 1 << TABLE_BITS,
+        TABLE_MASK      = TABLE_SIZE - 1
+    };
+
+    // Kinds of page
+    enum {
+        PAGE_UNKNOWN,                   // Not yet resolved from the regions
+        PAGE_UNMAPPED,                  // Reads give zero, writes are ignored
+        PAGE_RAM,                       // Host memory
+        PAGE_ROM,                       // Host memory, writes are ignored
+        PAGE_MMIO,                      // Accesses go to the ffi hooks
+        PAGE_SPLIT                      // Part RAM, part ROM (setMemory only)
+    };
+
+    // A direct mapped TLB entry. The tag is the page number of the access,
+    // before memMask is applied, or ~0 if the entry is empty.
+    struct TLB {
+        Addr            tag;            // Page number
+        Byte           *host;           // Host address of the page
+    };
+
+    // A page table entry. An MMIO page keeps the addresses of any memory it
+    // hides for the fallbacks.
+    struct PAGE {
+        const Byte     *rd;             // Host address for loads, or NULL
+        Byte           *wr;             // Host address for stores, or NULL
+        const DEVICE   *device;         // Handlers of an MMIO page, or NULL
+        Byte            kind;           // Kind of page
+        unsigned int    epoch;          // Epoch the page was last saved in
+        unsigned int    dirtied;        // Generation it was last marked dirty in
+        Qword           code;           // Blocks watched by watchCode
+        Byte            watch;          // Kinds of watchpoint on the page
+    };
+
+    // An address range given to one of the map functions
+    struct REGION {
+        Addr            first;          // First page number
+        Addr            last;           // Last page number
+        Byte           *host;           // Host address of the first page
+        Byte            kind;           // Kind of page
+        const DEVICE   *device;         // Handlers of MMIO pages, or NULL
+    };
+
+    // An address range given to setWatchpoint
+    struct WATCH {
+        Addr            base;           // First address
+        Addr            size;           // Length in bytes
+        unsigned int    kinds;          // Kinds of access caught
+    };
+
+    // A memory file holding the RAM of an image, closed along with its last
+    // user so that any number of restores share one descriptor
+    struct MEMFILE {
+        ~MEMFILE();
+
+        int             fd;             // The open file
+    };
+
+    typedef std::shared_ptr<MEMFILE> MEMREF;
+
+    // Host memory reserved on behalf of the guest
+    struct SPARSE {
+        Byte           *host;           // Start of the mapping
+        Addr            size;           // Length of the mapping
+        MEMREF          file;           // Image file mapped, or empty
+        Addr            offset;         // Offset of the mapping in the file
+    };
+
+    // A ROM image file mapped read-only, unmapped along with its last user
+    struct ROMFILE {
+        ~ROMFILE();
+
+        Byte           *host;           // Start of the mapping
+        Addr            size;           // Length of the file
+    };
+
+    typedef std::shared_ptr<ROMFILE> ROMREF;
+    typedef std::shared_ptr<const DEVICE> DEVREF;
+
+    // A run of host pages copied into an image
+    struct BLOCK {
+        Byte           *host;           // Start when the image was captured
+        Addr            size;           // Length in bytes
+        Addr            offset;         // Offset in the image file
+    };
+
+    static Byte *reserve(Addr size);
+    void release();
+
+    static Byte *translate(const IMAGE &image, const std::vector<Byte *> &hosts, const Byte *host);
+
+    void addRegion(Addr first, Addr last, Byte *pHost, Byte kind);
+    void flush();
+    void freeTable(void **table, unsigned int level);
+
+    PAGE &lookup(Addr ea);
+
+    void storeCode(PAGE &page, Addr ea, unsigned int size);
+
+    // Note a store to a page as dirty and save it for the undo log, the
+    // first time in each generation or epoch
+    inline void touch(PAGE &page, Addr ea)
     {
-        setByteF(ea + 0, lo_b(data));
-        setByteF(ea + 1, hi_b(data));
+        if (page.dirtied != generation)
+            mark(page, ea);
+        if (tracking && page.epoch != epoch)
+            save(page, ea);
     }
 
-    // Write a dword to memory
-    inline static void setDwordF(Addr ea, Dword data)
+    void mark(PAGE &page, Addr ea);
+
+    void save(PAGE &page, Addr ea);
+
+    // Check an access to a page against the watchpoints if any on the page
+    // are for its kind
+    inline void check(const PAGE &page, Addr ea, unsigned int size, unsigned int kind)
     {
-        setWordF(ea + 0, lo_w(data));
-        setWordF(ea + 2, hi_w(data));
+        if (page.watch & kind)
+            watched(ea, size, kind);
     }
 
-    // Write a qword to memory
-    inline static void setQwordF(Addr ea, Qword data)
+    void watched(Addr ea, unsigned int size, unsigned int kind);
+    Byte watchKinds(Addr vpn) const;
+    void rewatch(void **table, unsigned int level, Addr prefix);
+
+    const Byte *readable(Addr ea, unsigned int size);
+    Byte *writable(Addr ea, unsigned int size);
+
+    static void copy(Byte *dst, const Byte *src, Addr count, bool down);
+
+    // Test if memMask keeps whole pages together so they can be cached
+    inline bool pageable() const
     {
-        setDwordF(ea + 0, lo_d(data));
-        setDwordF(ea + 4, hi_d(data));
+        return ((memMask & PAGE_MASK) == PAGE_MASK);
     }
 
-protected:
-    mem65x64();
-    ~mem65x64();
+    Qword readMmio(const PAGE &page, Addr ea, unsigned int size);
+    void writeMmio(const PAGE &page, Addr ea, unsigned int size, Qword data);
+
+    static Qword readDevice(const DEVICE &device, Addr ea, unsigned int size);
+    static void writeDevice(const DEVICE &device, Addr ea, unsigned int size, Qword data);
+
+    Byte getByteSlow(Addr ea);
+    Word getWordSlow(Addr ea);
+    Dword getDwordSlow(Addr ea);
+    Qword getQwordSlow(Addr ea);
+
+    void setByteSlow(Addr ea, Byte data);
+    void setWordSlow(Addr ea, Word data);
+    void setDwordSlow(Addr ea, Dword data);
+    void setQwordSlow(Addr ea, Qword data);
+
+    Addr                memMask;        // The address mask pattern
+    Addr                ramSize;        // The amount of RAM
+
+    Byte               *pRAM;           // Base of RAM memory array
+    const Byte         *pROM;           // Base of ROM memory array
+    std::vector<SPARSE> owned;          // RAM reserved by setMemory and mapSparse
+    std::vector<ROMREF> files;          // ROM files mapped by mapRomFile
+    std::vector<DEVREF> devices;        // Devices mapped by mapDevice
+
+    std::vector<REGION> regions;        // Regions in the order they were mapped
+    void              **root;           // Top level of the page table
+
+    TLB                 rdTlb[TLB_SIZE]; // Pages that can be read directly
+    TLB                 wrTlb[TLB_SIZE]; // Pages that can be written directly
+
+    bool                tracking;       // Pages are saved before stores
+    unsigned int        epoch;          // Advanced by seal()
+    std::vector<BLOCK>  changed;        // Pages saved in this epoch
+    std::vector<Byte>   before;         // Their contents when saved
+
+    unsigned int        generation;     // Advanced when dirty bits are cleared
+    std::unordered_map<Addr, Qword> dirty; // Dirty bits, 64 pages to a word
+
+    std::vector<WATCH>  watches;        // Watchpoints in the order they were set
+
+    static thread_local mem65x64 *current; // Memory bound to this thread
+};
+
+// A frozen copy of a memory map. The RAM behind it is held in a memory file
+// that restore() maps copy-on-write, so every instance started from the
+// image shares the pages it has not written to.
+struct mem65x64::IMAGE
+{
+    IMAGE();
+    ~IMAGE();
+
+    MEMREF              file;           // Memory file holding the RAM
+    std::vector<BLOCK>  blocks;         // Host memory copied into the file
+    std::vector<REGION> regions;        // Regions, with their capture hosts
+    Addr                memMask;        // The address mask pattern
+    Addr                ramSize;        // The amount of setMemory RAM
+    Byte               *pRAM;           // Base of setMemory RAM when captured
+    const Byte         *pROM;           // Base of setMemory ROM
+    std::vector<ROMREF> files;          // ROM files the regions use
+    std::vector<DEVREF> devices;        // Devices the regions use
 
 private:
-    static Addr         memMask;        // The address mask pattern
-    static Addr         ramSize;        // The amount of RAM
+    IMAGE(const IMAGE &);
+    IMAGE &operator=(const IMAGE &);
+};
 
-    static Byte       *pRAM;            // Base of RAM memory array
-    static const Byte *pROM;            // Base of ROM memory array
+// The contents of RAM pages before their first store in an epoch, in the
+// order they were saved
+struct mem65x64::UNDO
+{
+    std::vector<BLOCK>  blocks;         // Host pages, with offsets into data
+    std::vector<Byte>   data;
 };
 
 extern "C" {
@@ -22,6 +22,8 @@
 #ifndef NOZO65X64_H
 #define NOZO65X64_H
 
+#include <string.h>
+
 // The nozo65x64 class defines common types for 8-, 16-, 32- and 64-bit data values and
 // a set of common functions for manipulating them.
 
@@ -83,7 +85,7 @@ public:
     // Combine two words into a dword
     inline static Dword join_d(Word l, Word h)
     {
-        return (l | (h << 16));
+        return (l | ((Dword)h << 16));
     }
 
     // Combine two dwords into a qword
@@ -110,6 +112,113 @@ public:
         return ((value >> 32) | (value << 32));
     }
 
+    // Load a little-endian word from a host address of any alignment
+    inline static Word load_w(const Byte *ptr)
+    {
+        return (join_w(ptr[0], ptr[1]));
+    }
+
+    // Load a little-endian dword from a host address of any alignment
+    inline static Dword load_d(const Byte *ptr)
+    {
+        unsigned int value;
+
+        memcpy(&value, ptr, 4);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        value = __builtin_bswap32(value);
+#endif
+        return ((Dword) value);
+    }
+
+    // Load a little-endian qword from a host address of any alignment
+    inline static Qword load_q(const Byte *ptr)
+    {
+        Qword value;
+
+        memcpy(&value, ptr, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        value = __builtin_bswap64(value);
+#endif
+        return (value);
+    }
+
+    // Store a little-endian word to a host address of any alignment
+    inline static void store_w(Byte *ptr, Word value)
+    {
+        ptr[0] = lo_b(value);
+        ptr[1] = hi_b(value);
+    }
+
+    // Store a little-endian dword to a host address of any alignment
+    inline static void store_d(Byte *ptr, Dword value)
+    {
+        unsigned int data = (unsigned int) value;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        data = __builtin_bswap32(data);
+#endif
+        memcpy(ptr, &data, 4);
+    }
+
+    // Store a little-endian qword to a host address of any alignment
+    inline static void store_q(Byte *ptr, Qword value)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        value = __builtin_bswap64(value);
+#endif
+        memcpy(ptr, &value, 8);
+    }
+
+    // Add two packed BCD values of bits bits (a multiple of 4, up to 16
+    // digits) and a carry. All digits are adjusted at once: every digit is
+    // biased by 6 so that a decimal carry becomes a binary one, then the bias
+    // is taken back out of the digits that did not carry. The carry out of
+    // the top digit is returned through carry.
+    inline static Qword add_bcd(Qword l, Qword r, bool &carry, unsigned int bits = 64)
+    {
+        Qword biased = l + 0x6666666666666666;
+        Qword sum = biased + r + carry;
+        Qword carries = sum ^ biased ^ r;
+        Qword unbias;
+
+        carry = (sum < biased);
+        unbias = ~carries & 0x1111111111111110;
+        unbias = (unbias >> 2) | (unbias >> 3);
+        unbias |= (Qword)!carry * 0x6000000000000000;
+        sum -= unbias;
+
+        // A narrower sum carries into the digit above it
+        if (bits < 64) {
+            carry = (sum >> bits) & 1;
+            sum &= ((Qword)1 << bits) - 1;
+        }
+        return (sum);
+    }
+
+    // Return the nines' complement of a packed BCD value of bits bits
+    inline static Qword nines_bcd(Qword r, unsigned int bits = 64)
+    {
+        return ((0x9999999999999999 >> (64 - bits)) - r);
+    }
+
+    // Subtract packed BCD values of bits bits by adding the nines' complement
+    // of r. As with binary subtraction carry is set when nothing is borrowed.
+    inline static Qword sub_bcd(Qword l, Qword r, bool &carry, unsigned int bits = 64)
+    {
+        return (add_bcd(l, nines_bcd(r, bits), carry, bits));
+    }
+
+    // Test if the packed BCD sum of l and r overflowed when all three are read
+    // as ten's complement, where a top digit of 5 or more is negative
+    inline static bool overflow_bcd(Qword l, Qword r, Qword sum, unsigned int bits = 64)
+    {
+        bool ln = ((l >> (bits - 4)) & 0xf) >= 5;
+        bool rn = ((r >> (bits - 4)) & 0xf) >= 5;
+        bool sn = ((sum >> (bits - 4)) & 0xf) >= 5;
+
+        return (ln == rn && sn != ln);
+    }
+
 protected:
     nozo65x64();
     ~nozo65x64();
@@ -0,0 +1,290 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+#ifndef OPS65X64_H
+#define OPS65X64_H
+
+// The NOZOTECH 65x64 opcode table. Each entry gives the opcode, the name of its
+// op_ handler, the name of its am_ addressing mode, the trace mnemonic, the
+// instruction length in bytes (opcode included) and the base cycle count.
+//
+// Opcodes without an implementation are routed to op_und so that every entry
+// is decoded explicitly.
+
+#define OPS65X64(OP) \
+    OP(0x00, brk,  immb, "BRK", 2,  8) \
+    OP(0x01, ora,  dpix, "ORA", 5,  5) \
+    OP(0x02, cop,  immb, "COP", 2,  7) \
+    OP(0x03, ora,  srel, "ORA", 3,  3) \
+    OP(0x04, tsb,  dpag, "TSB", 5,  5) \
+    OP(0x05, ora,  dpag, "ORA", 5,  3) \
+    OP(0x06, asl,  dpag, "ASL", 5,  5) \
+    OP(0x07, und,  impl, "???", 1,  2) \
+    OP(0x08, php,  impl, "PHP", 1,  3) \
+    OP(0x09, und,  impl, "???", 1,  2) \
+    OP(0x0a, asla, acc,  "ASL", 1,  2) \
+    OP(0x0b, phd,  impl, "PHD", 1,  4) \
+    OP(0x0c, tsb,  absl, "TSB", 9,  6) \
+    OP(0x0d, ora,  absl, "ORA", 9,  4) \
+    OP(0x0e, asl,  absl, "ASL", 9,  6) \
+    OP(0x0f, und,  impl, "???", 1,  2) \
+    OP(0x10, bpl,  rela, "BPL", 3,  3) \
+    OP(0x11, ora,  dpiy, "ORA", 5,  5) \
+    OP(0x12, ora,  dpgi, "ORA", 5,  5) \
+    OP(0x13, ora,  sriy, "ORA", 3,  5) \
+    OP(0x14, trb,  dpag, "TRB", 5,  5) \
+    OP(0x15, ora,  dpgx, "ORA", 5,  3) \
+    OP(0x16, asl,  dpgx, "ASL", 5,  5) \
+    OP(0x17, und,  impl, "???", 1,  2) \
+    OP(0x18, clc,  impl, "CLC", 1,  2) \
+    OP(0x19, ora,  absy, "ORA", 9,  4) \
+    OP(0x1a, inca, acc,  "INC", 1,  2) \
+    OP(0x1b, tcs,  impl, "TCS", 1,  2) \
+    OP(0x1c, trb,  absl, "TRB", 9,  6) \
+    OP(0x1d, ora,  absx, "ORA", 9,  4) \
+    OP(0x1e, asl,  absx, "ASL", 9,  6) \
+    OP(0x1f, und,  impl, "???", 1,  2) \
+    OP(0x20, jsr,  absl, "JSR", 9,  6) \
+    OP(0x21, and,  dpix, "AND", 5,  6) \
+    OP(0x22, und,  impl, "???", 1,  2) \
+    OP(0x23, and,  srel, "AND", 3,  4) \
+    OP(0x24, bit,  dpag, "BIT", 5,  3) \
+    OP(0x25, and,  dpag, "AND", 5,  4) \
+    OP(0x26, rol,  dpag, "ROL", 5,  5) \
+    OP(0x27, und,  impl, "???", 1,  2) \
+    OP(0x28, plp,  impl, "PLP", 1,  4) \
+    OP(0x29, und,  impl, "???", 1,  2) \
+    OP(0x2a, rola, acc,  "ROL", 1,  2) \
+    OP(0x2b, pld,  impl, "PLD", 1,  5) \
+    OP(0x2c, bit,  absl, "BIT", 9,  4) \
+    OP(0x2d, and,  absl, "AND", 9,  5) \
+    OP(0x2e, rol,  absl, "ROL", 9,  6) \
+    OP(0x2f, und,  impl, "???", 1,  2) \
+    OP(0x30, bmi,  rela, "BMI", 3,  3) \
+    OP(0x31, and,  dpiy, "AND", 5,  6) \
+    OP(0x32, and,  dpgi, "AND", 5,  6) \
+    OP(0x33, and,  sriy, "AND", 3,  6) \
+    OP(0x34, bit,  dpgx, "BIT", 5,  3) \
+    OP(0x35, and,  dpgx, "AND", 5,  4) \
+    OP(0x36, rol,  dpgx, "ROL", 5,  5) \
+    OP(0x37, und,  impl, "???", 1,  2) \
+    OP(0x38, sec,  impl, "SEC", 1,  2) \
+    OP(0x39, and,  absy, "AND", 9,  5) \
+    OP(0x3a, deca, acc,  "DEC", 1,  2) \
+    OP(0x3b, tsc,  impl, "TSC", 1,  2) \
+    OP(0x3c, bit,  absx, "BIT", 9,  4) \
+    OP(0x3d, and,  absx, "AND", 9,  5) \
+    OP(0x3e, rol,  absx, "ROL", 9,  6) \
+    OP(0x3f, und,  impl, "???", 1,  2) \
+    OP(0x40, rti,  impl, "RTI", 1,  7) \
+    OP(0x41, eor,  dpix, "EOR", 5,  5) \
+    OP(0x42, wdm,  immb, "WDM", 2,  3) \
+    OP(0x43, eor,  srel, "EOR", 3,  3) \
+    OP(0x44, mvp,  immw, "MVP", 3,  8) \
+    OP(0x45, eor,  dpag, "EOR", 5,  3) \
+    OP(0x46, lsr,  dpag, "LSR", 5,  5) \
+    OP(0x47, und,  impl, "???", 1,  2) \
+    OP(0x48, pha,  impl, "PHA", 1,  3) \
+    OP(0x49, und,  impl, "???", 1,  2) \
+    OP(0x4a, lsra, impl, "LSR", 1,  2) \
+    OP(0x4b, phk,  impl, "PHK", 1,  3) \
+    OP(0x4c, jmp,  absl, "JMP", 9,  3) \
+    OP(0x4d, eor,  absl, "EOR", 9,  4) \
+    OP(0x4e, lsr,  absl, "LSR", 9,  6) \
+    OP(0x4f, und,  impl, "???", 1,  2) \
+    OP(0x50, bvc,  rela, "BVC", 3,  3) \
+    OP(0x51, eor,  dpiy, "EOR", 5,  5) \
+    OP(0x52, eor,  dpgi, "EOR", 5,  5) \
+    OP(0x53, eor,  sriy, "EOR", 3,  5) \
+    OP(0x54, mvn,  immw, "MVN", 3,  8) \
+    OP(0x55, eor,  dpgx, "EOR", 5,  3) \
+    OP(0x56, lsr,  dpgx, "LSR", 5,  5) \
+    OP(0x57, und,  impl, "???", 1,  2) \
+    OP(0x58, cli,  impl, "CLI", 1,  2) \
+    OP(0x59, eor,  absy, "EOR", 9,  4) \
+    OP(0x5a, phy,  impl, "PHY", 1,  3) \
+    OP(0x5b, tcd,  impl, "TCD", 1,  2) \
+    OP(0x5c, und,  impl, "???", 1,  2) \
+    OP(0x5d, eor,  absx, "EOR", 9,  4) \
+    OP(0x5e, lsr,  absx, "LSR", 9,  6) \
+    OP(0x5f, und,  impl, "???", 1,  2) \
+    OP(0x60, rts,  impl, "RTS", 1,  6) \
+    OP(0x61, adc,  dpix, "ADC", 5,  5) \
+    OP(0x62, per,  lrel, "PER", 5,  8) \
+    OP(0x63, adc,  srel, "ADC", 3,  3) \
+    OP(0x64, stz,  dpag, "STZ", 5,  3) \
+    OP(0x65, adc,  dpag, "ADC", 5,  3) \
+    OP(0x66, ror,  dpag, "ROR", 5,  5) \
+    OP(0x67, und,  impl, "???", 1,  2) \
+    OP(0x68, pla,  impl, "PLA", 1,  4) \
+    OP(0x69, adc,  immq, "ADC", 9,  9) \
+    OP(0x6a, rora, impl, "ROR", 1,  2) \
+    OP(0x6b, rtl,  impl, "RTL", 1,  6) \
+    OP(0x6c, jmp,  absi, "JMP", 9,  5) \
+    OP(0x6d, adc,  absl, "ADC", 9,  4) \
+    OP(0x6e, ror,  absl, "ROR", 9,  6) \
+    OP(0x6f, und,  impl, "???", 1,  2) \
+    OP(0x70, bvs,  rela, "BVS", 3,  3) \
+    OP(0x71, adc,  dpiy, "ADC", 5,  5) \
+    OP(0x72, adc,  dpgi, "ADC", 5,  5) \
+    OP(0x73, adc,  sriy, "ADC", 3,  5) \
+    OP(0x74, stz,  dpgx, "STZ", 5,  3) \
+    OP(0x75, adc,  dpgx, "ADC", 5,  3) \
+    OP(0x76, ror,  dpgx, "ROR", 5,  5) \
+    OP(0x77, und,  impl, "???", 1,  2) \
+    OP(0x78, sei,  impl, "SEI", 1,  2) \
+    OP(0x79, adc,  absy, "ADC", 9,  4) \
+    OP(0x7a, ply,  impl, "PLY", 1,  4) \
+    OP(0x7b, tdc,  impl, "TDC", 1,  2) \
+    OP(0x7c, jmp,  abxi, "JMP", 3,  5) \
+    OP(0x7d, adc,  absx, "ADC", 9,  4) \
+    OP(0x7e, ror,  absx, "ROR", 9,  6) \
+    OP(0x7f, und,  impl, "???", 1,  2) \
+    OP(0x80, bra,  rela, "BRA", 3,  4) \
+    OP(0x81, sta,  dpix, "STA", 5,  5) \
+    OP(0x82, brl,  lrel, "BRL", 5,  5) \
+    OP(0x83, sta,  srel, "STA", 3,  3) \
+    OP(0x84, sty,  dpag, "STY", 5,  3) \
+    OP(0x85, sta,  dpag, "STA", 5,  3) \
+    OP(0x86, stx,  dpag, "STX", 5,  3) \
+    OP(0x87, und,  impl, "???", 1,  2) \
+    OP(0x88, dey,  impl, "DEY", 1,  2) \
+    OP(0x89, und,  impl, "???", 1,  2) \
+    OP(0x8a, txa,  impl, "TXA", 1,  2) \
+    OP(0x8b, phb,  impl, "PHB", 1,  3) \
+    OP(0x8c, sty,  absl, "STY", 9,  4) \
+    OP(0x8d, sta,  absl, "STA", 9,  4) \
+    OP(0x8e, stx,  absl, "STX", 9,  4) \
+    OP(0x8f, und,  impl, "???", 1,  2) \
+    OP(0x90, bcc,  rela, "BCC", 3,  3) \
+    OP(0x91, sta,  dpiy, "STA", 5,  5) \
+    OP(0x92, sta,  dpgi, "STA", 5,  5) \
+    OP(0x93, sta,  sriy, "STA", 3,  5) \
+    OP(0x94, sty,  dpgx, "STY", 5,  3) \
+    OP(0x95, sta,  dpgx, "STA", 5,  3) \
+    OP(0x96, stx,  dpgy, "STX", 5,  3) \
+    OP(0x97, und,  impl, "???", 1,  2) \
+    OP(0x98, tya,  impl, "TYA", 1,  2) \
+    OP(0x99, sta,  absy, "STA", 9,  4) \
+    OP(0x9a, txs,  impl, "TXS", 1,  2) \
+    OP(0x9b, txy,  impl, "TXY", 1,  2) \
+    OP(0x9c, stz,  absl, "STZ", 9,  4) \
+    OP(0x9d, sta,  absx, "STA", 9,  4) \
+    OP(0x9e, stz,  absx, "STZ", 9,  4) \
+    OP(0x9f, und,  impl, "???", 1,  2) \
+    OP(0xa0, und,  impl, "???", 1,  2) \
+    OP(0xa1, lda,  dpix, "LDA", 5,  5) \
+    OP(0xa2, und,  impl, "???", 1,  2) \
+    OP(0xa3, lda,  srel, "LDA", 3,  3) \
+    OP(0xa4, ldy,  dpag, "LDY", 5,  3) \
+    OP(0xa5, lda,  dpag, "LDA", 5,  3) \
+    OP(0xa6, ldx,  dpag, "LDX", 5,  3) \
+    OP(0xa7, und,  impl, "???", 1,  2) \
+    OP(0xa8, tay,  impl, "TAY", 1,  2) \
+    OP(0xa9, und,  impl, "???", 1,  2) \
+    OP(0xaa, tax,  impl, "TAX", 1,  2) \
+    OP(0xab, plb,  impl, "PLB", 1,  4) \
+    OP(0xac, ldy,  absl, "LDY", 9,  4) \
+    OP(0xad, lda,  absl, "LDA", 9,  4) \
+    OP(0xae, ldx,  absl, "LDX", 9,  4) \
+    OP(0xaf, und,  impl, "???", 1,  2) \
+    OP(0xb0, bcs,  rela, "BCS", 3,  3) \
+    OP(0xb1, lda,  dpiy, "LDA", 5,  5) \
+    OP(0xb2, lda,  dpgi, "LDA", 5,  5) \
+    OP(0xb3, lda,  sriy, "LDA", 3,  5) \
+    OP(0xb4, ldy,  dpgx, "LDY", 5,  3) \
+    OP(0xb5, lda,  dpgx, "LDA", 5,  3) \
+    OP(0xb6, ldx,  dpgy, "LDX", 5,  3) \
+    OP(0xb7, und,  impl, "???", 1,  2) \
+    OP(0xb8, clv,  impl, "CLV", 1,  2) \
+    OP(0xb9, lda,  absy, "LDA", 9,  4) \
+    OP(0xba, tsx,  impl, "TSX", 1,  2) \
+    OP(0xbb, tyx,  impl, "TYX", 1,  2) \
+    OP(0xbc, ldy,  absx, "LDY", 9,  4) \
+    OP(0xbd, lda,  absx, "LDA", 9,  4) \
+    OP(0xbe, ldx,  absy, "LDX", 9,  4) \
+    OP(0xbf, und,  impl, "???", 1,  2) \
+    OP(0xc0, und,  impl, "???", 1,  2) \
+    OP(0xc1, cmp,  dpix, "CMP", 5,  5) \
+    OP(0xc2, rep,  immb, "REP", 2,  3) \
+    OP(0xc3, cmp,  srel, "CMP", 3,  3) \
+    OP(0xc4, cpy,  dpag, "CPY", 5,  3) \
+    OP(0xc5, cmp,  dpag, "CMP", 5,  3) \
+    OP(0xc6, dec,  dpag, "DEC", 5,  5) \
+    OP(0xc7, und,  impl, "???", 1,  2) \
+    OP(0xc8, iny,  impl, "INY", 1,  2) \
+    OP(0xc9, und,  impl, "???", 1,  2) \
+    OP(0xca, dex,  impl, "DEX", 1,  2) \
+    OP(0xcb, wai,  impl, "WAI", 1,  3) \
+    OP(0xcc, cpy,  absl, "CPY", 9,  4) \
+    OP(0xcd, cmp,  absl, "CMP", 9,  4) \
+    OP(0xce, dec,  absl, "DEC", 9,  6) \
+    OP(0xcf, und,  impl, "???", 1,  2) \
+    OP(0xd0, bne,  rela, "BNE", 3,  3) \
+    OP(0xd1, cmp,  dpiy, "CMP", 5,  5) \
+    OP(0xd2, cmp,  dpgi, "CMP", 5,  5) \
+    OP(0xd3, cmp,  sriy, "CMP", 3,  5) \
+    OP(0xd4, pei,  dpag, "PEI", 5,  7) \
+    OP(0xd5, cmp,  dpgx, "CMP", 5,  3) \
+    OP(0xd6, dec,  dpgx, "DEC", 5,  5) \
+    OP(0xd7, und,  impl, "???", 1,  2) \
+    OP(0xd8, cld,  impl, "CLD", 1,  2) \
+    OP(0xd9, cmp,  absy, "CMP", 9,  4) \
+    OP(0xda, phx,  impl, "PHX", 1,  3) \
+    OP(0xdb, stp,  impl, "STP", 1,  3) \
+    OP(0xdc, und,  impl, "???", 1,  2) \
+    OP(0xdd, cmp,  absx, "CMP", 9,  4) \
+    OP(0xde, dec,  absx, "DEC", 9,  6) \
+    OP(0xdf, und,  impl, "???", 1,  2) \
+    OP(0xe0, und,  impl, "???", 1,  2) \
+    OP(0xe1, sbc,  dpix, "SBC", 5,  5) \
+    OP(0xe2, sep,  immb, "SEP", 2,  3) \
+    OP(0xe3, sbc,  srel, "SBC", 3,  3) \
+    OP(0xe4, cpx,  dpag, "CPX", 5,  3) \
+    OP(0xe5, sbc,  dpag, "SBC", 5,  3) \
+    OP(0xe6, inc,  dpag, "INC", 5,  5) \
+    OP(0xe7, und,  impl, "???", 1,  2) \
+    OP(0xe8, inx,  impl, "INX", 1,  2) \
+    OP(0xe9, und,  impl, "???", 1,  2) \
+    OP(0xea, nop,  impl, "NOP", 1,  2) \
+    OP(0xeb, xba,  impl, "XBA", 1,  3) \
+    OP(0xec, cpx,  absl, "CPX", 9,  4) \
+    OP(0xed, sbc,  absl, "SBC", 9,  4) \
+    OP(0xee, inc,  absl, "INC", 9,  6) \
+    OP(0xef, und,  impl, "???", 1,  2) \
+    OP(0xf0, beq,  rela, "BEQ", 3,  3) \
+    OP(0xf1, sbc,  dpiy, "SBC", 5,  5) \
+    OP(0xf2, sbc,  dpgi, "SBC", 5,  5) \
+    OP(0xf3, sbc,  sriy, "SBC", 3,  5) \
+    OP(0xf4, pea,  immw, "PEA", 3,  6) \
+    OP(0xf5, sbc,  dpgx, "SBC", 5,  3) \
+    OP(0xf6, inc,  dpgx, "INC", 5,  5) \
+    OP(0xf7, und,  impl, "???", 1,  2) \
+    OP(0xf8, sed,  impl, "SED", 1,  2) \
+    OP(0xf9, sbc,  absy, "SBC", 9,  4) \
+    OP(0xfa, plx,  impl, "PLX", 1,  4) \
+    OP(0xfb, xce,  impl, "XCE", 1,  2) \
+    OP(0xfc, jsr,  abxi, "JSR", 3,  8) \
+    OP(0xfd, sbc,  absx, "SBC", 9,  4) \
+    OP(0xfe, inc,  absx, "INC", 9,  6) \
+    OP(0xff, und,  impl, "???", 1,  2)
+
+#endif
@@ -0,0 +1,163 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+// Checks the word parallel packed BCD helpers in nozo65x64 against a digit by
+// digit reference for random operands of every width and both carry values.
+//
+//      g++ -O2 -I.. bcd65x64.cpp -o bcd65x64 && ./bcd65x64
+//
+// The exit status is the number of mismatches found (capped at 255).
+
+#include <stdio.h>
+
+#include "nozo65x64.hpp"
+
+typedef nozo65x64::Qword Qword;
+
+static Qword seed = 0x2545f4914f6cdd1d;
+
+// Return the next value of a xorshift generator
+static Qword random64()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed);
+}
+
+// Return a random valid packed BCD value of bits bits
+static Qword random_bcd(unsigned int bits)
+{
+    Qword value = 0;
+
+    for (unsigned int shift = 0; shift < bits; shift += 4)
+        value |= (random64() % 10) << shift;
+    return (value);
+}
+
+// Add one digit at a time, carrying into the next
+static Qword add_digits(Qword l, Qword r, bool &carry, unsigned int bits)
+{
+    Qword sum = 0;
+    unsigned int c = carry;
+
+    for (unsigned int shift = 0; shift < bits; shift += 4) {
+        unsigned int d = ((l >> shift) & 0xf) + ((r >> shift) & 0xf) + c;
+
+        c = d >= 10;
+        sum |= (Qword)(c ? d - 10 : d) << shift;
+    }
+    carry = c;
+    return (sum);
+}
+
+// Subtract one digit at a time, borrowing from the next. Carry is set when
+// nothing is borrowed.
+static Qword sub_digits(Qword l, Qword r, bool &carry, unsigned int bits)
+{
+    Qword diff = 0;
+    int b = !carry;
+
+    for (unsigned int shift = 0; shift < bits; shift += 4) {
+        int d = (int)((l >> shift) & 0xf) - (int)((r >> shift) & 0xf) - b;
+
+        b = d < 0;
+        diff |= (Qword)(b ? d + 10 : d) << shift;
+    }
+    carry = !b;
+    return (diff);
+}
+
+// Return a packed BCD value read as ten's complement
+static __int128 signed_digits(Qword value, unsigned int bits)
+{
+    __int128 result = 0;
+    __int128 scale = 1;
+
+    for (unsigned int shift = 0; shift < bits; shift += 4) {
+        result += scale * ((value >> shift) & 0xf);
+        scale *= 10;
+    }
+    if (((value >> (bits - 4)) & 0xf) >= 5)
+        result -= scale;
+    return (result);
+}
+
+// Test if a signed result lies outside the ten's complement range
+static bool out_of_range(__int128 value, unsigned int bits)
+{
+    __int128 half = 5;
+
+    for (unsigned int shift = 4; shift < bits; shift += 4)
+        half *= 10;
+    return (value < -half || value >= half);
+}
+
+static unsigned int failures = 0;
+
+static void check(const char *what, unsigned int bits, Qword l, Qword r,
+    bool carry, Qword got, Qword want, bool gotc, bool wantc)
+{
+    if (got == want && gotc == wantc)
+        return;
+
+    if (failures++ < 20)
+        printf("%s/%u %016llx %016llx c=%d: got %016llx c=%d want %016llx c=%d\n",
+            what, bits, l, r, carry, got, gotc, want, wantc);
+}
+
+int main()
+{
+    static const unsigned int widths[] = { 8, 16, 32, 64 };
+
+    for (unsigned int bits : widths) {
+        for (int n = 0; n < 200000; ++n) {
+            Qword l = random_bcd(bits);
+            Qword r = random_bcd(bits);
+
+            for (int c = 0; c < 2; ++c) {
+                bool gotc = c, wantc = c;
+                Qword got = nozo65x64::add_bcd(l, r, gotc, bits);
+                Qword want = add_digits(l, r, wantc, bits);
+
+                check("add", bits, l, r, c, got, want, gotc, wantc);
+                check("add v", bits, l, r, c,
+                    nozo65x64::overflow_bcd(l, r, got, bits),
+                    out_of_range(signed_digits(l, bits) + signed_digits(r, bits) + c, bits),
+                    0, 0);
+
+                gotc = c;
+                wantc = c;
+                got = nozo65x64::sub_bcd(l, r, gotc, bits);
+                want = sub_digits(l, r, wantc, bits);
+
+                check("sub", bits, l, r, c, got, want, gotc, wantc);
+                check("sub v", bits, l, r, c,
+                    nozo65x64::overflow_bcd(l, nozo65x64::nines_bcd(r, bits), got, bits),
+                    out_of_range(signed_digits(l, bits) - signed_digits(r, bits) - !c, bits),
+                    0, 0);
+            }
+        }
+    }
+
+    printf("%u mismatches\n", failures);
+    return (failures > 255 ? 255 : failures);
+}
@@ -0,0 +1,286 @@
+//==============================================================================
+//                         ____  _____       ____    ___
+//                        / ___||  ___|     / ___|  /   |
+//    ___ _ __ ___  _   _/ /___ |___ \__  _/ /___  / /| |
+//   / _ \ '_ ` _ \| | | | ___ \    \ \ \/ / ___ \/ /_| |
+//  |  __/ | | | | | |_| | \_/ |/\__/ />  <| \_/ |\___  |
+//   \___|_| |_| |_|\__,_\_____/\____//_/\_\_____/    |_/
+//
+// A Portable C++ NOZOTECH 65x64 Emulator
+//------------------------------------------------------------------------------
+// Copyright (C),2024 KyokoToreno
+// Based on the work of: (C),2016 Andrew John Jacobs
+// All rights reserved.
+//
+// This work is made available under the terms of the Creative Commons
+// Attribution-NonCommercial-ShareAlike 4.0 International license. Open the
+// following URL to see the details.
+//
+// http://creativecommons.org/licenses/by-nc-sa/4.0/
+//------------------------------------------------------------------------------
+
+// Runs random programs on two emulators, one translating hot code with the
+// jit and one only interpreting, and checks that the registers, the cycle
+// count and memory agree after every slice of the run. The programs mix the
+// loads, stores, compares, branches and flag and index instructions that the
+// jit translates with REP/SEP width changes and stores into their own code.
+//
+//      g++ -O2 -I.. jit65x64.cpp ../emu65x64.cpp ../jit65x64.cpp
+//          ../journal65x64.cpp ../mem65x64.cpp ../nozo65x64.cpp
+//          -o jit65x64 -lpthread && ./jit65x64 [programs [seed]]
+//
+// The exit status is the number of programs that differed (capped at 255).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu65x64.hpp"
+
+typedef nozo65x64::Byte Byte;
+typedef nozo65x64::Word Word;
+typedef nozo65x64::Qword Qword;
+
+// Memory layout of a test program
+enum {
+    MEMORY_SIZE     = 0x10000,          // RAM, wrapping around
+    CODE_END        = 0x1000,           // Code runs from zero up to here
+    DATA_BASE       = 0xc000,           // Operands point from here up
+    DATA_SIZE       = 0x3ff8,
+    SLICE           = 997,              // Instructions run between checks
+    SLICES          = 40                // Checks made on each program
+};
+
+// Translated instructions in absolute and direct page modes
+static const Byte absolute[] = {
+    0xad, 0xae, 0xac, 0x8d, 0x8e, 0x8c, 0x9c, 0x2d, 0x0d, 0x4d, 0xcd, 0xec,
+    0xcc, 0xbd, 0xb9, 0xbe, 0xbc, 0x9d, 0x99, 0x9e, 0x3d, 0x1d, 0x5d, 0xdd,
+    0xd9
+};
+
+static const Byte direct[] = {
+    0xa5, 0xa6, 0xa4, 0x85, 0x86, 0x84, 0x64, 0x25, 0x05, 0x45, 0xc5, 0xe4,
+    0xc4, 0xb5, 0xb6, 0xb4, 0x95, 0x96, 0x94, 0x74, 0x35, 0x15, 0x55, 0xd5
+};
+
+// STA, STX, STY and STZ absolute, for stores into the code
+static const Byte stores[] = { 0x8d, 0x8e, 0x8c, 0x9c };
+
+// INX, INY, DEX, DEY, CLC, SEC, CLV, NOP, and INC A and DEC A which are not
+// translated, to make the jit leave and re-enter its blocks
+static const Byte implied[] = {
+    0xe8, 0xc8, 0xca, 0x88, 0x18, 0x38, 0xb8, 0xea, 0x1a, 0x3a
+};
+
+// BPL, BMI, BVC, BVS, BCC, BCS, BNE and BEQ
+static const Byte branches[] = {
+    0x10, 0x30, 0x50, 0x70, 0x90, 0xb0, 0xd0, 0xf0
+};
+
+static Qword seed = 0x2545f4914f6cdd1d;
+
+static Byte memory[2][MEMORY_SIZE];
+
+// Return the next value of a xorshift generator
+static Qword random64()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed);
+}
+
+// Store size bytes of value little-endian at addr
+static void put(Byte *at, Qword value, unsigned int size)
+{
+    for (unsigned int index = 0; index < size; ++index)
+        at[index] = (Byte)(value >> (8 * index));
+}
+
+// Fill memory with random data and a random program that loops back to the
+// start once it reaches CODE_END
+static void generate(Byte *ram)
+{
+    Qword starts[CODE_END];
+    unsigned int count = 0;
+    Qword pc = 0;
+
+    for (Qword addr = 0; addr < MEMORY_SIZE; ++addr)
+        ram[addr] = (Byte)random64();
+
+    while (pc < CODE_END - 16) {
+        unsigned int kind = random64() % 100;
+
+        starts[count++] = pc;
+        if (kind < 30) {
+            Qword ea = DATA_BASE + random64() % DATA_SIZE;
+
+            if (random64() % 16 == 0)
+                ea = random64();        // Anywhere, wrapping
+            ram[pc] = absolute[random64() % sizeof(absolute)];
+            put(ram + pc + 1, ea, 8);
+            pc += 9;
+        }
+        else if (kind < 48) {
+            ram[pc] = direct[random64() % sizeof(direct)];
+            put(ram + pc + 1, DATA_BASE + random64() % DATA_SIZE, 4);
+            pc += 5;
+        }
+        else if (kind < 54 && count > 1) {
+            // Change an operand, or now and then an opcode, of earlier code
+            Qword at = starts[random64() % (count - 1)];
+
+            ram[pc] = stores[random64() % sizeof(stores)];
+            put(ram + pc + 1, at + ((random64() % 8) ? 1 + random64() % 4 : 0), 8);
+            pc += 9;
+        }
+        else if (kind < 72)
+            ram[pc++] = implied[random64() % sizeof(implied)];
+        else if (kind < 86) {
+            Word offset = (Word)(random64() % 96 - 64);
+
+            ram[pc] = branches[random64() % sizeof(branches)];
+            put(ram + pc + 1, offset, 2);
+            pc += 3;
+        }
+        else if (kind < 94) {
+            static const Byte widths[] = { 0x10, 0x20, 0x30 };
+
+            ram[pc] = (random64() & 1) ? 0xc2 : 0xe2; // REP or SEP
+            ram[pc + 1] = widths[random64() % 3];
+            pc += 2;
+        }
+        else {
+            ram[pc] = 0x80;             // BRA backwards
+            put(ram + pc + 1, (Word)(-3 - (int)(random64() % 256)), 2);
+            pc += 3;
+        }
+    }
+
+    ram[pc] = 0x80;                     // BRA to the start
+    put(ram + pc + 1, (Word)(-3 - (int)pc), 2);
+}
+
+// Test if the state visible to the guest is the same in both emulators
+static bool same(emu65x64 &l, emu65x64 &r)
+{
+    return (l.pc == r.pc && l.cycles == r.cycles &&
+        l.a.q == r.a.q && l.b.q == r.b.q && l.c.q == r.c.q &&
+        l.x.q == r.x.q && l.y.q == r.y.q && l.z.q == r.z.q &&
+        l.sp.q == r.sp.q && l.dp.q == r.dp.q && l.e == r.e &&
+        (l.p.b & 0x3c) == (r.p.b & 0x3c) &&
+        !l.fn == !r.fn && !l.fv == !r.fv && !l.fc == !r.fc && !l.fz == !r.fz &&
+        l.isStopped() == r.isStopped() &&
+        !memcmp(memory[0], memory[1], MEMORY_SIZE));
+}
+
+// Run a program with the jit and without it, returning false if they differ
+static bool check(unsigned int program)
+{
+    emu65x64 plain, jitted;
+    bool wide = random64() & 1;
+
+    generate(memory[0]);
+    memcpy(memory[1], memory[0], MEMORY_SIZE);
+
+    plain.setMemory(MEMORY_SIZE - 1, MEMORY_SIZE, memory[0], NULL);
+    jitted.setMemory(MEMORY_SIZE - 1, MEMORY_SIZE, memory[1], NULL);
+    plain.reset(false);
+    jitted.reset(false);
+    if (!jitted.setJit(true)) {
+        printf("jit unavailable\n");
+        exit(1);
+    }
+    plain.pc = jitted.pc = 0;
+    plain.e = jitted.e = !wide;
+
+    for (unsigned int slice = 0; slice < SLICES; ++slice) {
+        emu65x64::RESULT l = plain.run(0, SLICE);
+        emu65x64::RESULT r = jitted.run(0, SLICE);
+
+        if (l != r || !same(plain, jitted)) {
+            printf("program %u differs after slice %u: pc %llx/%llx cycles %lu/%lu "
+                "a %llx/%llx x %llx/%llx y %llx/%llx\n", program, slice,
+                (unsigned long long)plain.pc, (unsigned long long)jitted.pc,
+                plain.cycles, jitted.cycles,
+                (unsigned long long)plain.a.q, (unsigned long long)jitted.a.q,
+                (unsigned long long)plain.x.q, (unsigned long long)jitted.x.q,
+                (unsigned long long)plain.y.q, (unsigned long long)jitted.y.q);
+            return (false);
+        }
+
+        // Stores into the code can make STP, WAI or WDM #$ff of anything
+        if (l == emu65x64::RUN_STOPPED)
+            break;
+        if (l == emu65x64::RUN_HALTED) {
+            plain.interrupt();
+            jitted.interrupt();
+        }
+    }
+    return (true);
+}
+
+extern "C" {
+    // The programs only use RAM, so the ffi hooks just use the fallbacks
+
+    unsigned char read_byte(unsigned long long addr)
+    {
+        return mem65x64_getByteF(addr);
+    }
+
+    unsigned short read_word(unsigned long long addr)
+    {
+        return mem65x64_getWordF(addr);
+    }
+
+    unsigned long read_dword(unsigned long long addr)
+    {
+        return mem65x64_getDwordF(addr);
+    }
+
+    unsigned long long read_qword(unsigned long long addr)
+    {
+        return mem65x64_getQwordF(addr);
+    }
+
+    void write_byte(unsigned long long addr, unsigned char data)
+    {
+        mem65x64_setByteF(addr, data);
+    }
+
+    void write_word(unsigned long long addr, unsigned short data)
+    {
+        mem65x64_setWordF(addr, data);
+    }
+
+    void write_dword(unsigned long long addr, unsigned long data)
+    {
+        mem65x64_setDwordF(addr, data);
+    }
+
+    void write_qword(unsigned long long addr, unsigned long long data)
+    {
+        mem65x64_setQwordF(addr, data);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int programs = (argc > 1) ? atoi(argv[1]) : 2000;
+    unsigned int failures = 0;
+
+    if (argc > 2)
+        seed = strtoull(argv[2], NULL, 0) | 1;
+
+    // A store into the code can make a WDM #$02, which reads the console
+    if (!freopen("/dev/null", "r", stdin))
+        return (1);
+
+    for (unsigned int program = 0; program < programs; ++program) {
+        if (!check(program))
+            ++failures;
+    }
+
+    printf("%u programs, %u differed\n", programs, failures);
+    return (failures > 255 ? 255 : failures);
+}
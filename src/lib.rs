@@ -1,16 +1,144 @@
 #[cfg(feature = "bevy" )]
 pub mod prelude;
 
+use std::ffi::{c_char, c_int, c_void, CString};
+use std::io;
+use std::sync::Arc;
+
+// Interrupt lines for raise() and lower()
+pub const LINE_IRQ: u32 = 1 << 0;
+pub const LINE_NMI: u32 = 1 << 1;
+pub const LINE_ABORT: u32 = 1 << 2;
+
+// Kinds of access for set_watchpoint()
+pub const WATCH_READ: u32 = 1 << 0;
+pub const WATCH_WRITE: u32 = 1 << 1;
+
+// Called with its context and due cycle once a scheduled event is reached
+pub type EventHandler = extern "C" fn(context: *mut c_void, when: u64);
+
+// The handlers of a device for map_device(), each given the context and the
+// address of an access. A width without a handler is made of two accesses of
+// half the size. Without a byte handler reads give zero and writes are
+// ignored.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct Device {
+    pub context: *mut c_void,
+    pub read_byte: Option<extern "C" fn(context: *mut c_void, addr: u64) -> u8>,
+    pub read_word: Option<extern "C" fn(context: *mut c_void, addr: u64) -> u16>,
+    pub read_dword: Option<extern "C" fn(context: *mut c_void, addr: u64) -> u32>,
+    pub read_qword: Option<extern "C" fn(context: *mut c_void, addr: u64) -> u64>,
+    pub write_byte: Option<extern "C" fn(context: *mut c_void, addr: u64, data: u8)>,
+    pub write_word: Option<extern "C" fn(context: *mut c_void, addr: u64, data: u16)>,
+    pub write_dword: Option<extern "C" fn(context: *mut c_void, addr: u64, data: u32)>,
+    pub write_qword: Option<extern "C" fn(context: *mut c_void, addr: u64, data: u64)>,
+}
+
+// Opaque C++ emulator instance
+#[repr(C)]
+struct Handle {
+    _private: [u8; 0],
+}
+
+// Opaque C++ snapshot
+#[repr(C)]
+struct SnapshotHandle {
+    _private: [u8; 0],
+}
+
 #[link(name = "emu65x64")]
 extern "C" {
-    fn emu65x64_setMemory(memMask: u64, ramSize: u64, pRom: *const u8);
+    fn emu65x64_setMemory(memMask: u64, ramSize: u64, pRom: *const u8) -> bool;
     fn emu65x64_setMemoryRam(memMask: u64, ramSize: u64, pRam: *mut u8, pRom: *const u8);
+    fn emu65x64_mapRam(base: u64, size: u64, pHost: *mut u8);
+    fn emu65x64_mapRom(base: u64, size: u64, pHost: *const u8);
+    fn emu65x64_mapRomFile(base: u64, path: *const c_char) -> bool;
+    fn emu65x64_unmap(base: u64, size: u64);
+    fn emu65x64_mapSparse(base: u64, size: u64) -> bool;
+    fn emu65x64_mapMmio(base: u64, size: u64);
+    fn emu65x64_mapDevice(base: u64, size: u64, device: *const Device);
+    fn emu65x64_getCommitted() -> u64;
+    fn emu65x64_getHugeCommitted() -> u64;
+    fn emu65x64_getDirty(base: u64, size: u64, bitmap: *mut u8) -> u64;
+    fn emu65x64_clearDirty(base: u64, size: u64);
 
     fn emu65x64_reset(trace: bool);
-    fn emu65x64_step();
-    fn emu65x64_getCycles() -> u32;
+    fn emu65x64_step() -> u32;
+    fn emu65x64_setJit(enable: bool) -> bool;
+    fn emu65x64_getCycles() -> u64;
     fn emu65x64_isStopped() -> bool;
     fn emu65x64_setPc(value: u64);
+    fn emu65x64_run(maxCycles: u64, maxInstructions: u64) -> u32;
+    fn emu65x64_setBreakpoint(addr: u64);
+    fn emu65x64_clearBreakpoint(addr: u64);
+    fn emu65x64_setWatchpoint(base: u64, size: u64, kinds: u32);
+    fn emu65x64_clearWatchpoint(base: u64, size: u64);
+    fn emu65x64_getWatchAddr() -> u64;
+    fn emu65x64_getWatchKind() -> u32;
+    fn emu65x64_interrupt();
+    fn emu65x64_wait();
+    fn emu65x64_raise(lines: u32);
+    fn emu65x64_lower(lines: u32);
+    fn emu65x64_schedule(when: u64, handler: EventHandler, context: *mut c_void) -> u64;
+    fn emu65x64_cancel(id: u64) -> bool;
+    fn emu65x64_snapshot(snapshot: *mut *mut SnapshotHandle) -> c_int;
+    fn emu65x64_restore(snapshot: *const SnapshotHandle) -> c_int;
+    fn emu65x64_freeSnapshot(snapshot: *mut SnapshotHandle);
+    fn emu65x64_record(path: *const c_char) -> bool;
+    fn emu65x64_replay(path: *const c_char) -> bool;
+    fn emu65x64_stopJournal() -> bool;
+    fn emu65x64_isReplaying() -> bool;
+    fn emu65x64_hasDiverged() -> bool;
+    fn emu65x64_setHistory(interval: u64, depth: u32) -> bool;
+    fn emu65x64_reverseStep() -> bool;
+    fn emu65x64_reverseContinue() -> bool;
+
+    fn emu65x64_create() -> *mut Handle;
+    fn emu65x64_destroy(emu: *mut Handle);
+    fn emu65x64_setMemoryH(emu: *mut Handle, memMask: u64, ramSize: u64, pRom: *const u8) -> bool;
+    fn emu65x64_setMemoryRamH(emu: *mut Handle, memMask: u64, ramSize: u64, pRam: *mut u8, pRom: *const u8);
+    fn emu65x64_mapRamH(emu: *mut Handle, base: u64, size: u64, pHost: *mut u8);
+    fn emu65x64_mapRomH(emu: *mut Handle, base: u64, size: u64, pHost: *const u8);
+    fn emu65x64_mapRomFileH(emu: *mut Handle, base: u64, path: *const c_char) -> bool;
+    fn emu65x64_unmapH(emu: *mut Handle, base: u64, size: u64);
+    fn emu65x64_mapSparseH(emu: *mut Handle, base: u64, size: u64) -> bool;
+    fn emu65x64_mapMmioH(emu: *mut Handle, base: u64, size: u64);
+    fn emu65x64_mapDeviceH(emu: *mut Handle, base: u64, size: u64, device: *const Device);
+    fn emu65x64_getCommittedH(emu: *mut Handle) -> u64;
+    fn emu65x64_getHugeCommittedH(emu: *mut Handle) -> u64;
+    fn emu65x64_getDirtyH(emu: *mut Handle, base: u64, size: u64, bitmap: *mut u8) -> u64;
+    fn emu65x64_clearDirtyH(emu: *mut Handle, base: u64, size: u64);
+    fn emu65x64_resetH(emu: *mut Handle, trace: bool);
+    fn emu65x64_stepH(emu: *mut Handle) -> u32;
+    fn emu65x64_setJitH(emu: *mut Handle, enable: bool) -> bool;
+    fn emu65x64_getCyclesH(emu: *mut Handle) -> u64;
+    fn emu65x64_isStoppedH(emu: *mut Handle) -> bool;
+    fn emu65x64_setPcH(emu: *mut Handle, value: u64);
+    fn emu65x64_runH(emu: *mut Handle, maxCycles: u64, maxInstructions: u64) -> u32;
+    fn emu65x64_setBreakpointH(emu: *mut Handle, addr: u64);
+    fn emu65x64_clearBreakpointH(emu: *mut Handle, addr: u64);
+    fn emu65x64_setWatchpointH(emu: *mut Handle, base: u64, size: u64, kinds: u32);
+    fn emu65x64_clearWatchpointH(emu: *mut Handle, base: u64, size: u64);
+    fn emu65x64_getWatchAddrH(emu: *mut Handle) -> u64;
+    fn emu65x64_getWatchKindH(emu: *mut Handle) -> u32;
+    fn emu65x64_interruptH(emu: *mut Handle);
+    fn emu65x64_waitH(emu: *mut Handle);
+    fn emu65x64_raiseH(emu: *mut Handle, lines: u32);
+    fn emu65x64_lowerH(emu: *mut Handle, lines: u32);
+    fn emu65x64_scheduleH(emu: *mut Handle, when: u64, handler: EventHandler, context: *mut c_void) -> u64;
+    fn emu65x64_cancelH(emu: *mut Handle, id: u64) -> bool;
+    fn emu65x64_snapshotH(emu: *mut Handle, snapshot: *mut *mut SnapshotHandle) -> c_int;
+    fn emu65x64_restoreH(emu: *mut Handle, snapshot: *const SnapshotHandle) -> c_int;
+    fn emu65x64_forkH(snapshot: *const SnapshotHandle, emu: *mut *mut Handle) -> c_int;
+    fn emu65x64_recordH(emu: *mut Handle, path: *const c_char) -> bool;
+    fn emu65x64_replayH(emu: *mut Handle, path: *const c_char) -> bool;
+    fn emu65x64_stopJournalH(emu: *mut Handle) -> bool;
+    fn emu65x64_isReplayingH(emu: *mut Handle) -> bool;
+    fn emu65x64_hasDivergedH(emu: *mut Handle) -> bool;
+    fn emu65x64_setHistoryH(emu: *mut Handle, interval: u64, depth: u32) -> bool;
+    fn emu65x64_reverseStepH(emu: *mut Handle) -> bool;
+    fn emu65x64_reverseContinueH(emu: *mut Handle) -> bool;
     /*
     fn emu65x64_getFlags() -> u8;
     fn emu65x64_getPc() -> u64;
@@ -49,18 +177,61 @@ extern "C" {
     fn mem65x64_setQwordF(addr: u64, data: u64);
 }
 
-pub fn set_memory(mem_mask: u64, ram_size: u64, rom: Option<&[u8]>) {
+// Why a call to run or step returned
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum StopReason {
+    // The cycle or instruction budget is used up
+    Budget,
+    // WDM #$ff has stopped the emulator
+    Stopped,
+    // STP or WAI is waiting for an interrupt
+    Halted,
+    // The next instruction is at a breakpoint
+    Breakpoint,
+    // An interrupt has been raised
+    Interrupt,
+    // The last instruction accessed a watched address
+    Watchpoint,
+}
+
+impl StopReason {
+    fn from_raw(reason: u32) -> Self {
+        match reason {
+            1 => StopReason::Stopped,
+            2 => StopReason::Halted,
+            3 => StopReason::Breakpoint,
+            4 => StopReason::Interrupt,
+            5 => StopReason::Watchpoint,
+            _ => StopReason::Budget,
+        }
+    }
+}
+
+// Give the guest ram_size bytes of zeroed RAM from address zero, followed by
+// rom up to the top of mem_mask. Returns false, leaving the memory map as it
+// was, if the host cannot reserve that much address space.
+//
+// Safety: the emulator keeps a pointer to rom. It must stay alive and
+// unchanged, and cover every guest address above the RAM up to mem_mask,
+// until the memory map is replaced.
+pub unsafe fn set_memory(mem_mask: u64, ram_size: u64, rom: Option<&[u8]>) -> bool {
     unsafe {
         let p_rom = match rom {
             Some(rom) => rom.as_ptr(),
             None => std::ptr::null(),
         };
 
-        emu65x64_setMemory(mem_mask, ram_size, p_rom);
+        emu65x64_setMemory(mem_mask, ram_size, p_rom)
     }
 }
 
-pub fn set_memory_ram(mem_mask: u64, ram_size: u64, ram: &mut [u8], rom: Option<&[u8]>) {
+// As set_memory(), with the RAM in a host buffer of at least ram_size bytes
+//
+// Safety: the emulator keeps pointers to ram and rom as for set_memory().
+// Both must stay alive until the memory map is replaced, and ram must not be
+// accessed other than through the emulator meanwhile.
+pub unsafe fn set_memory_ram(mem_mask: u64, ram_size: u64, ram: &mut [u8], rom: Option<&[u8]>) {
+    assert!(ram_size <= ram.len() as u64);
     unsafe {
         let p_rom = match rom {
             Some(rom) => rom.as_ptr(),
@@ -71,15 +242,303 @@ pub fn set_memory_ram(mem_mask: u64, ram_size: u64, ram: &mut [u8], rom: Option<
     }
 }
 
+// Map a host buffer as guest RAM at base. Regions are 4K page granular and
+// later mappings hide earlier ones.
+//
+// Safety: the emulator keeps a pointer to ram and maps the last page in
+// full, so the buffer must cover whole 4K pages. It must stay alive, and not
+// be accessed other than through the emulator, until the pages are mapped
+// over or the memory map is replaced. Snapshots take a copy of it.
+pub unsafe fn map_ram(base: u64, ram: &mut [u8]) {
+    unsafe {
+        emu65x64_mapRam(base, ram.len() as u64, ram.as_mut_ptr());
+    }
+}
+
+// Map a host buffer as guest ROM at base. Guest writes to it are ignored.
+//
+// Safety: the emulator keeps a pointer to rom and maps the last page in full,
+// so the buffer must cover whole 4K pages. It must stay alive and unchanged
+// until the pages are mapped over or the memory map is replaced, and as long
+// as any snapshot taken meanwhile, which shares it.
+pub unsafe fn map_rom(base: u64, rom: &[u8]) {
+    unsafe {
+        emu65x64_mapRom(base, rom.len() as u64, rom.as_ptr());
+    }
+}
+
+// Map a ROM image file at base straight from the page cache, without
+// reading it into a buffer first
+pub fn map_rom_file(base: u64, path: &str) -> bool {
+    let Ok(path) = CString::new(path) else { return false };
+    unsafe {
+        emu65x64_mapRomFile(base, path.as_ptr())
+    }
+}
+
+// Remove base..base + size from the guest address space. Reads of unmapped
+// pages return zero and writes are ignored.
+pub fn unmap(base: u64, size: u64) {
+    unsafe {
+        emu65x64_unmap(base, size);
+    }
+}
+
+// Map size bytes of zeroed guest RAM at base. Host memory is only committed
+// for the pages the guest touches. Returns false, mapping nothing, if the
+// host cannot reserve that much address space.
+pub fn map_sparse(base: u64, size: u64) -> bool {
+    unsafe {
+        emu65x64_mapSparse(base, size)
+    }
+}
+
+// Send guest accesses to base..base + size through the read_* and write_*
+// hooks. All other RAM and ROM pages are accessed directly.
+pub fn map_mmio(base: u64, size: u64) {
+    unsafe {
+        emu65x64_mapMmio(base, size);
+    }
+}
+
+// Send guest accesses to base..base + size to a device's handlers instead of
+// the hooks. The handlers are copied but the context must outlive the mapping.
+pub fn map_device(base: u64, size: u64, device: &Device) {
+    unsafe {
+        emu65x64_mapDevice(base, size, device);
+    }
+}
+
+// Bytes of sparse RAM (set_memory and map_sparse) committed by the host
+pub fn get_committed() -> u64 {
+    unsafe {
+        emu65x64_getCommitted()
+    }
+}
+
+// How much of that the host backs with 2 MiB huge pages
+pub fn get_huge_committed() -> u64 {
+    unsafe {
+        emu65x64_getHugeCommitted()
+    }
+}
+
+// Bytes of bitmap needed for the 4K pages covering base..base + size
+fn dirty_bytes(base: u64, size: u64) -> usize {
+    if size == 0 {
+        return 0;
+    }
+    let pages = ((base + size - 1) >> 12) - (base >> 12) + 1;
+    ((pages + 7) / 8) as usize
+}
+
+// A bit for each 4K page covering base..base + size, set if the guest has
+// stored to RAM in it since the bit was last cleared
+pub fn get_dirty(base: u64, size: u64) -> Vec<u8> {
+    let mut bitmap = vec![0u8; dirty_bytes(base, size)];
+    unsafe {
+        emu65x64_getDirty(base, size, bitmap.as_mut_ptr());
+    }
+    bitmap
+}
+
+pub fn clear_dirty(base: u64, size: u64) {
+    unsafe {
+        emu65x64_clearDirty(base, size);
+    }
+}
+
 pub fn reset(trace: bool) {
     unsafe {
         emu65x64_reset(trace);
     }
 }
 
-pub fn step() {
+// Execute one instruction. While STP or WAI is waiting for an interrupt
+// nothing is executed and StopReason::Halted is returned at once, so a host
+// that loops on step() should call wait() rather than spin.
+pub fn step() -> StopReason {
+    unsafe {
+        StopReason::from_raw(emu65x64_step())
+    }
+}
+
+// Translate hot code to native x86-64 (true) or interpret everything (false).
+// Returns false if translation is not available on this host. Tracing and
+// breakpoints always use the interpreter.
+pub fn set_jit(enable: bool) -> bool {
+    unsafe {
+        emu65x64_setJit(enable)
+    }
+}
+
+// Execute until max_cycles cycles or max_instructions instructions have been
+// used (zero means no limit) or the emulator needs attention.
+pub fn run(max_cycles: u64, max_instructions: u64) -> StopReason {
+    unsafe {
+        StopReason::from_raw(emu65x64_run(max_cycles, max_instructions))
+    }
+}
+
+pub fn set_breakpoint(addr: u64) {
+    unsafe {
+        emu65x64_setBreakpoint(addr);
+    }
+}
+
+pub fn clear_breakpoint(addr: u64) {
+    unsafe {
+        emu65x64_clearBreakpoint(addr);
+    }
+}
+
+// Stop run() after any instruction that makes a WATCH_READ or WATCH_WRITE
+// access, as given by kinds, to the bytes from base to base + size - 1.
+// Only the pages holding them are slowed down.
+pub fn set_watchpoint(base: u64, size: u64, kinds: u32) {
     unsafe {
-        emu65x64_step();
+        emu65x64_setWatchpoint(base, size, kinds);
+    }
+}
+
+pub fn clear_watchpoint(base: u64, size: u64) {
+    unsafe {
+        emu65x64_clearWatchpoint(base, size);
+    }
+}
+
+// The address and kind of the access that last stopped at a watchpoint
+pub fn get_watch_hit() -> (u64, u32) {
+    unsafe {
+        (emu65x64_getWatchAddr(), emu65x64_getWatchKind())
+    }
+}
+
+pub fn interrupt() {
+    unsafe {
+        emu65x64_interrupt();
+    }
+}
+
+// Block until an interrupt ends STP or WAI
+pub fn wait() {
+    unsafe {
+        emu65x64_wait();
+    }
+}
+
+// Raise interrupt lines. The IRQ line stays raised until lowered.
+pub fn raise(lines: u32) {
+    unsafe {
+        emu65x64_raise(lines);
+    }
+}
+
+pub fn lower(lines: u32) {
+    unsafe {
+        emu65x64_lower(lines);
+    }
+}
+
+// Call handler with context once the cycle count reaches when. Returns an id
+// for cancel().
+pub fn schedule(when: u64, handler: EventHandler, context: *mut c_void) -> u64 {
+    unsafe {
+        emu65x64_schedule(when, handler, context)
+    }
+}
+
+// Withdraw an event that has not run yet
+pub fn cancel(id: u64) -> bool {
+    unsafe {
+        emu65x64_cancel(id)
+    }
+}
+
+// Turn the errno value returned by a snapshot call into a Result
+fn checked(error: c_int) -> io::Result<()> {
+    match error {
+        0 => Ok(()),
+        error => Err(io::Error::from_raw_os_error(error)),
+    }
+}
+
+// Capture the registers and memory. Fails if the host cannot hold a copy of
+// the RAM.
+pub fn snapshot() -> io::Result<Snapshot> {
+    let mut handle = std::ptr::null_mut();
+
+    unsafe {
+        checked(emu65x64_snapshot(&mut handle))?;
+    }
+    Ok(Snapshot { handle })
+}
+
+// Return to the state held in a snapshot. On failure the memory map is left
+// as it was.
+pub fn restore(snapshot: &Snapshot) -> io::Result<()> {
+    unsafe {
+        checked(emu65x64_restore(snapshot.handle))
+    }
+}
+
+// Log the non-deterministic inputs of the run to a new file at path. The log
+// is written out each time run() returns.
+pub fn record(path: &str) -> bool {
+    let Ok(path) = CString::new(path) else { return false };
+    unsafe {
+        emu65x64_record(path.as_ptr())
+    }
+}
+
+// Feed back a log made by record() from the state it was recorded from
+pub fn replay(path: &str) -> bool {
+    let Ok(path) = CString::new(path) else { return false };
+    unsafe {
+        emu65x64_replay(path.as_ptr())
+    }
+}
+
+// Finish recording or replaying. Returns false if some of a recording could
+// not be written, in which case it ended at the first failed write.
+pub fn stop_journal() -> bool {
+    unsafe {
+        emu65x64_stopJournal()
+    }
+}
+
+pub fn is_replaying() -> bool {
+    unsafe {
+        emu65x64_isReplaying()
+    }
+}
+
+// Test if the last replay stopped because the run no longer matched it
+pub fn has_diverged() -> bool {
+    unsafe {
+        emu65x64_hasDiverged()
+    }
+}
+
+// Keep depth checkpoints taken every interval cycles so that execution can
+// be stepped backwards. An interval of zero stops keeping them.
+pub fn set_history(interval: u64, depth: u32) -> bool {
+    unsafe {
+        emu65x64_setHistory(interval, depth)
+    }
+}
+
+// Go back to the instruction before the current one
+pub fn reverse_step() -> bool {
+    unsafe {
+        emu65x64_reverseStep()
+    }
+}
+
+// Go back to the last breakpoint reached
+pub fn reverse_continue() -> bool {
+    unsafe {
+        emu65x64_reverseContinue()
     }
 }
 /*
@@ -216,12 +675,416 @@ pub fn set_z(value: u64) {
 }
  */
 
+pub fn get_cycles() -> u64 {
+    unsafe {
+        emu65x64_getCycles()
+    }
+}
+
+pub fn is_stopped() -> bool {
+    unsafe {
+        emu65x64_isStopped()
+    }
+}
+
 pub fn set_pc(value: u64) {
     unsafe {
         emu65x64_setPc(value)
     }
 }
 
+// Owns a native emulator, destroying it once the Emu65x64 and every
+// InterruptLine taken from it have been dropped
+struct Owner {
+    handle: *mut Handle,
+}
+
+// Only the thread safe interrupt calls are made through a shared Owner
+unsafe impl Send for Owner {}
+unsafe impl Sync for Owner {}
+
+impl Drop for Owner {
+    fn drop(&mut self) {
+        unsafe {
+            emu65x64_destroy(self.handle);
+        }
+    }
+}
+
+// An independent emulator. Each instance owns its registers and memory map,
+// so separate instances may be driven from separate threads.
+pub struct Emu65x64 {
+    handle: *mut Handle,
+    owner: Arc<Owner>,
+}
+
+unsafe impl Send for Emu65x64 {}
+
+// Raises and lowers the interrupt lines of an Emu65x64 from any thread,
+// including while another thread is inside its run() or wait(). The
+// emulator is kept alive until every handle has been dropped.
+#[derive(Clone)]
+pub struct InterruptLine {
+    owner: Arc<Owner>,
+}
+
+impl InterruptLine {
+    pub fn interrupt(&self) {
+        unsafe {
+            emu65x64_interruptH(self.owner.handle);
+        }
+    }
+
+    // Raise interrupt lines. The IRQ line stays raised until lowered.
+    pub fn raise(&self, lines: u32) {
+        unsafe {
+            emu65x64_raiseH(self.owner.handle, lines);
+        }
+    }
+
+    pub fn lower(&self, lines: u32) {
+        unsafe {
+            emu65x64_lowerH(self.owner.handle, lines);
+        }
+    }
+}
+
+impl Emu65x64 {
+    fn adopt(handle: *mut Handle) -> Self {
+        Emu65x64 { handle, owner: Arc::new(Owner { handle }) }
+    }
+
+    pub fn new() -> Self {
+        unsafe {
+            Emu65x64::adopt(emu65x64_create())
+        }
+    }
+
+    // Safety: as for the free function set_memory()
+    pub unsafe fn set_memory(&mut self, mem_mask: u64, ram_size: u64, rom: Option<&[u8]>) -> bool {
+        unsafe {
+            let p_rom = match rom {
+                Some(rom) => rom.as_ptr(),
+                None => std::ptr::null(),
+            };
+
+            emu65x64_setMemoryH(self.handle, mem_mask, ram_size, p_rom)
+        }
+    }
+
+    // Safety: as for the free function set_memory_ram()
+    pub unsafe fn set_memory_ram(&mut self, mem_mask: u64, ram_size: u64, ram: &mut [u8], rom: Option<&[u8]>) {
+        assert!(ram_size <= ram.len() as u64);
+        unsafe {
+            let p_rom = match rom {
+                Some(rom) => rom.as_ptr(),
+                None => std::ptr::null(),
+            };
+
+            emu65x64_setMemoryRamH(self.handle, mem_mask, ram_size, ram.as_mut_ptr(), p_rom);
+        }
+    }
+
+    // Safety: as for the free function map_ram()
+    pub unsafe fn map_ram(&mut self, base: u64, ram: &mut [u8]) {
+        unsafe {
+            emu65x64_mapRamH(self.handle, base, ram.len() as u64, ram.as_mut_ptr());
+        }
+    }
+
+    // Safety: as for the free function map_rom()
+    pub unsafe fn map_rom(&mut self, base: u64, rom: &[u8]) {
+        unsafe {
+            emu65x64_mapRomH(self.handle, base, rom.len() as u64, rom.as_ptr());
+        }
+    }
+
+    // Map a ROM image file at base straight from the page cache, without
+    // reading it into a buffer first
+    pub fn map_rom_file(&mut self, base: u64, path: &str) -> bool {
+        let Ok(path) = CString::new(path) else { return false };
+        unsafe {
+            emu65x64_mapRomFileH(self.handle, base, path.as_ptr())
+        }
+    }
+
+    pub fn unmap(&mut self, base: u64, size: u64) {
+        unsafe {
+            emu65x64_unmapH(self.handle, base, size);
+        }
+    }
+
+    pub fn map_sparse(&mut self, base: u64, size: u64) -> bool {
+        unsafe {
+            emu65x64_mapSparseH(self.handle, base, size)
+        }
+    }
+
+    pub fn map_mmio(&mut self, base: u64, size: u64) {
+        unsafe {
+            emu65x64_mapMmioH(self.handle, base, size);
+        }
+    }
+
+    pub fn map_device(&mut self, base: u64, size: u64, device: &Device) {
+        unsafe {
+            emu65x64_mapDeviceH(self.handle, base, size, device);
+        }
+    }
+
+    pub fn get_committed(&self) -> u64 {
+        unsafe {
+            emu65x64_getCommittedH(self.handle)
+        }
+    }
+
+    pub fn get_huge_committed(&self) -> u64 {
+        unsafe {
+            emu65x64_getHugeCommittedH(self.handle)
+        }
+    }
+
+    // A bit for each 4K page covering base..base + size, set if the guest
+    // has stored to RAM in it since the bit was last cleared
+    pub fn get_dirty(&self, base: u64, size: u64) -> Vec<u8> {
+        let mut bitmap = vec![0u8; dirty_bytes(base, size)];
+        unsafe {
+            emu65x64_getDirtyH(self.handle, base, size, bitmap.as_mut_ptr());
+        }
+        bitmap
+    }
+
+    pub fn clear_dirty(&mut self, base: u64, size: u64) {
+        unsafe {
+            emu65x64_clearDirtyH(self.handle, base, size);
+        }
+    }
+
+    pub fn reset(&mut self, trace: bool) {
+        unsafe {
+            emu65x64_resetH(self.handle, trace);
+        }
+    }
+
+    // Execute one instruction, returning StopReason::Halted without doing
+    // anything while STP or WAI is waiting for an interrupt
+    pub fn step(&mut self) -> StopReason {
+        unsafe {
+            StopReason::from_raw(emu65x64_stepH(self.handle))
+        }
+    }
+
+    pub fn set_jit(&mut self, enable: bool) -> bool {
+        unsafe {
+            emu65x64_setJitH(self.handle, enable)
+        }
+    }
+
+    pub fn run(&mut self, max_cycles: u64, max_instructions: u64) -> StopReason {
+        unsafe {
+            StopReason::from_raw(emu65x64_runH(self.handle, max_cycles, max_instructions))
+        }
+    }
+
+    pub fn set_breakpoint(&mut self, addr: u64) {
+        unsafe {
+            emu65x64_setBreakpointH(self.handle, addr);
+        }
+    }
+
+    pub fn clear_breakpoint(&mut self, addr: u64) {
+        unsafe {
+            emu65x64_clearBreakpointH(self.handle, addr);
+        }
+    }
+
+    pub fn set_watchpoint(&mut self, base: u64, size: u64, kinds: u32) {
+        unsafe {
+            emu65x64_setWatchpointH(self.handle, base, size, kinds);
+        }
+    }
+
+    pub fn clear_watchpoint(&mut self, base: u64, size: u64) {
+        unsafe {
+            emu65x64_clearWatchpointH(self.handle, base, size);
+        }
+    }
+
+    pub fn get_watch_hit(&self) -> (u64, u32) {
+        unsafe {
+            (emu65x64_getWatchAddrH(self.handle), emu65x64_getWatchKindH(self.handle))
+        }
+    }
+
+    pub fn interrupt(&self) {
+        unsafe {
+            emu65x64_interruptH(self.handle);
+        }
+    }
+
+    // Block until an interrupt ends STP or WAI
+    pub fn wait(&mut self) {
+        unsafe {
+            emu65x64_waitH(self.handle);
+        }
+    }
+
+    // Raise interrupt lines. The IRQ line stays raised until lowered.
+    pub fn raise(&self, lines: u32) {
+        unsafe {
+            emu65x64_raiseH(self.handle, lines);
+        }
+    }
+
+    pub fn lower(&self, lines: u32) {
+        unsafe {
+            emu65x64_lowerH(self.handle, lines);
+        }
+    }
+
+    // A handle for raising and lowering interrupt lines from other threads
+    pub fn interrupt_line(&self) -> InterruptLine {
+        InterruptLine { owner: self.owner.clone() }
+    }
+
+    // Call handler with context once the cycle count reaches when. Returns
+    // an id for cancel().
+    pub fn schedule(&mut self, when: u64, handler: EventHandler, context: *mut c_void) -> u64 {
+        unsafe {
+            emu65x64_scheduleH(self.handle, when, handler, context)
+        }
+    }
+
+    // Withdraw an event that has not run yet
+    pub fn cancel(&mut self, id: u64) -> bool {
+        unsafe {
+            emu65x64_cancelH(self.handle, id)
+        }
+    }
+
+    // Capture the registers and memory
+    pub fn snapshot(&self) -> io::Result<Snapshot> {
+        let mut handle = std::ptr::null_mut();
+
+        unsafe {
+            checked(emu65x64_snapshotH(self.handle, &mut handle))?;
+        }
+        Ok(Snapshot { handle })
+    }
+
+    // Return to the state held in a snapshot. RAM is shared with the
+    // snapshot until it is written.
+    pub fn restore(&mut self, snapshot: &Snapshot) -> io::Result<()> {
+        unsafe {
+            checked(emu65x64_restoreH(self.handle, snapshot.handle))
+        }
+    }
+
+    // Create another emulator that starts from a snapshot
+    pub fn fork(snapshot: &Snapshot) -> io::Result<Self> {
+        let mut handle = std::ptr::null_mut();
+
+        unsafe {
+            checked(emu65x64_forkH(snapshot.handle, &mut handle))?;
+        }
+        Ok(Emu65x64::adopt(handle))
+    }
+
+    // Log the non-deterministic inputs of the run to a new file at path
+    pub fn record(&mut self, path: &str) -> bool {
+        let Ok(path) = CString::new(path) else { return false };
+        unsafe {
+            emu65x64_recordH(self.handle, path.as_ptr())
+        }
+    }
+
+    // Feed back a log made by record() from the state it was recorded from
+    pub fn replay(&mut self, path: &str) -> bool {
+        let Ok(path) = CString::new(path) else { return false };
+        unsafe {
+            emu65x64_replayH(self.handle, path.as_ptr())
+        }
+    }
+
+    // Finish recording or replaying. Returns false if some of a recording
+    // could not be written.
+    pub fn stop_journal(&mut self) -> bool {
+        unsafe {
+            emu65x64_stopJournalH(self.handle)
+        }
+    }
+
+    pub fn is_replaying(&self) -> bool {
+        unsafe {
+            emu65x64_isReplayingH(self.handle)
+        }
+    }
+
+    // Test if the last replay stopped because the run no longer matched it
+    pub fn has_diverged(&self) -> bool {
+        unsafe {
+            emu65x64_hasDivergedH(self.handle)
+        }
+    }
+
+    // Keep depth checkpoints taken every interval cycles so that execution
+    // can be stepped backwards. An interval of zero stops keeping them.
+    pub fn set_history(&mut self, interval: u64, depth: u32) -> bool {
+        unsafe {
+            emu65x64_setHistoryH(self.handle, interval, depth)
+        }
+    }
+
+    // Go back to the instruction before the current one
+    pub fn reverse_step(&mut self) -> bool {
+        unsafe {
+            emu65x64_reverseStepH(self.handle)
+        }
+    }
+
+    // Go back to the last breakpoint reached
+    pub fn reverse_continue(&mut self) -> bool {
+        unsafe {
+            emu65x64_reverseContinueH(self.handle)
+        }
+    }
+
+    pub fn get_cycles(&self) -> u64 {
+        unsafe {
+            emu65x64_getCyclesH(self.handle)
+        }
+    }
+
+    pub fn is_stopped(&self) -> bool {
+        unsafe {
+            emu65x64_isStoppedH(self.handle)
+        }
+    }
+
+    pub fn set_pc(&mut self, value: u64) {
+        unsafe {
+            emu65x64_setPcH(self.handle, value)
+        }
+    }
+}
+
+// The registers and memory of an emulator at one moment. A snapshot is not
+// changed once taken, so any number of emulators may fork from it at once.
+pub struct Snapshot {
+    handle: *mut SnapshotHandle,
+}
+
+unsafe impl Send for Snapshot {}
+unsafe impl Sync for Snapshot {}
+
+impl Drop for Snapshot {
+    fn drop(&mut self) {
+        unsafe {
+            emu65x64_freeSnapshot(self.handle);
+        }
+    }
+}
+
 // Memory access
 #[no_mangle]
 extern "C" fn read_byte(addr: u64) -> u8 {